@@ -0,0 +1,207 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audio_mixer.h"
+
+struct s_audio_mixer_state {
+	int freq;
+	bool asigned;
+	bool a16bit;
+
+	int source_count;
+	audio_stream_state *sources[AUDIO_MIXER_MAX_SOURCES];
+	int gains[AUDIO_MIXER_MAX_SOURCES];
+
+	// per-call scratch space, grown on demand
+	int buffer_len;
+	s16 *scratch;
+	s32 *mix;
+};
+
+audio_mixer_state *audio_mixer_create(int freq, bool asigned, bool a16bit) {
+	audio_mixer_state *m = calloc(1, sizeof(audio_mixer_state));
+	if (m == NULL) {
+		return NULL;
+	}
+	m->freq = freq;
+	m->asigned = asigned;
+	m->a16bit = a16bit;
+	return m;
+}
+
+void audio_mixer_free(audio_mixer_state *m) {
+	if (m == NULL) {
+		return;
+	}
+	for (int i = 0; i < m->source_count; i++) {
+		audio_stream_free(m->sources[i]);
+	}
+	free(m->scratch);
+	free(m->mix);
+	free(m);
+}
+
+static int audio_mixer_clamp_gain(int gain) {
+	if (gain < 0) return 0;
+	if (gain > AUDIO_MIXER_GAIN_MAX) return AUDIO_MIXER_GAIN_MAX;
+	return gain;
+}
+
+static int audio_mixer_find_source(audio_mixer_state *m, audio_stream_state *s) {
+	for (int i = 0; i < m->source_count; i++) {
+		if (m->sources[i] == s) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+audio_stream_state *audio_mixer_add_source(audio_mixer_state *m, int gain) {
+	audio_stream_state *s;
+
+	if (m->source_count >= AUDIO_MIXER_MAX_SOURCES) {
+		fprintf(stderr, "audio mixer: too many sources (max %d)\n", AUDIO_MIXER_MAX_SOURCES);
+		return NULL;
+	}
+
+	// sources always render signed 16-bit at full volume; the mixer
+	// applies gain and converts to the output format
+	s = audio_stream_create(m->freq, true, true);
+	if (s == NULL) {
+		return NULL;
+	}
+	audio_stream_state_set_volume(s, audio_stream_get_max_volume());
+
+	m->sources[m->source_count] = s;
+	m->gains[m->source_count] = audio_mixer_clamp_gain(gain);
+	m->source_count++;
+	return s;
+}
+
+void audio_mixer_remove_source(audio_mixer_state *m, audio_stream_state *s) {
+	int i = audio_mixer_find_source(m, s);
+	if (i < 0) {
+		return;
+	}
+
+	m->source_count--;
+	m->sources[i] = m->sources[m->source_count];
+	m->gains[i] = m->gains[m->source_count];
+	audio_stream_free(s);
+}
+
+void audio_mixer_set_gain(audio_mixer_state *m, audio_stream_state *s, int gain) {
+	int i = audio_mixer_find_source(m, s);
+	if (i >= 0) {
+		m->gains[i] = audio_mixer_clamp_gain(gain);
+	}
+}
+
+int audio_mixer_get_source_count(audio_mixer_state *m) {
+	return m->source_count;
+}
+
+static bool audio_mixer_ensure_size(audio_mixer_state *m, int len) {
+	s16 *scratch;
+	s32 *mix;
+
+	if (len <= m->buffer_len) {
+		return true;
+	}
+
+	scratch = realloc(m->scratch, len * sizeof(s16));
+	if (scratch == NULL) {
+		return false;
+	}
+	m->scratch = scratch;
+
+	mix = realloc(m->mix, len * sizeof(s32));
+	if (mix == NULL) {
+		return false;
+	}
+	m->mix = mix;
+
+	m->buffer_len = len;
+	return true;
+}
+
+// The loops below are kept branch-free over restrict-qualified buffers so
+// that the compiler can vectorize them.
+
+static void audio_mixer_accumulate(s32 * restrict mix, const s16 * restrict src, int gain, int len) {
+	for (int i = 0; i < len; i++) {
+		mix[i] += src[i] * gain;
+	}
+}
+
+static void audio_mixer_resolve(s32 * restrict mix, int len) {
+	for (int i = 0; i < len; i++) {
+		s32 v = mix[i] >> 8;
+		v = v < -32768 ? -32768 : v;
+		v = v > 32767 ? 32767 : v;
+		mix[i] = v;
+	}
+}
+
+void audio_mixer_generate(audio_mixer_state *m, long time, u8 *stream, int len) {
+	int samples = m->a16bit ? (len >> 1) : len;
+	int i;
+
+	if (!audio_mixer_ensure_size(m, samples)) {
+		if (m->a16bit) {
+			u16 *stream16 = (u16*) stream;
+			for (i = 0; i < samples; i++) {
+				stream16[i] = m->asigned ? 0x0000 : 0x8000;
+			}
+		} else {
+			memset(stream, m->asigned ? 0 : 128, len);
+		}
+		return;
+	}
+
+	memset(m->mix, 0, samples * sizeof(s32));
+	for (i = 0; i < m->source_count; i++) {
+		// every source is generated, even when muted, to keep its
+		// event queue and timing moving
+		audio_stream_state_generate(m->sources[i], time, (u8*) m->scratch, samples * 2);
+		if (m->gains[i] > 0) {
+			audio_mixer_accumulate(m->mix, m->scratch, m->gains[i], samples);
+		}
+	}
+	audio_mixer_resolve(m->mix, samples);
+
+	if (m->a16bit) {
+		u16 *stream16 = (u16*) stream;
+		u16 xor = m->asigned ? 0x0000 : 0x8000;
+		for (i = 0; i < samples; i++) {
+			stream16[i] = ((u16) m->mix[i]) ^ xor;
+		}
+	} else {
+		u8 xor = m->asigned ? 0x00 : 0x80;
+		for (i = 0; i < samples; i++) {
+			stream[i] = ((u8) (m->mix[i] >> 8)) ^ xor;
+		}
+	}
+}
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __AUDIO_MIXER_H__
+#define __AUDIO_MIXER_H__
+
+#include "types.h"
+#include "audio_stream.h"
+
+#define AUDIO_MIXER_MAX_SOURCES 64
+#define AUDIO_MIXER_GAIN_UNITY 256
+#define AUDIO_MIXER_GAIN_MAX 1024
+
+typedef struct s_audio_mixer_state audio_mixer_state;
+
+// The mixer renders any number of speaker event streams (one per emulated
+// machine) into a single output buffer. Each source is an audio_stream_state
+// owned by the mixer; its emulator thread feeds it events through
+// audio_stream_state_append_on/off, exactly like the built-in stream.
+//
+// Gain is fixed-point, with AUDIO_MIXER_GAIN_UNITY being 1.0.
+//
+// Adding and removing sources must not race audio_mixer_generate().
+
+audio_mixer_state *audio_mixer_create(int freq, bool asigned, bool a16bit);
+void audio_mixer_free(audio_mixer_state *m);
+audio_stream_state *audio_mixer_add_source(audio_mixer_state *m, int gain);
+void audio_mixer_remove_source(audio_mixer_state *m, audio_stream_state *s);
+void audio_mixer_set_gain(audio_mixer_state *m, audio_stream_state *s, int gain);
+int audio_mixer_get_source_count(audio_mixer_state *m);
+void audio_mixer_generate(audio_mixer_state *m, long time, u8 *stream, int len);
+
+#endif
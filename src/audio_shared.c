@@ -27,9 +27,31 @@
 #include "audio_shared.h"
 #include "logging.h"
 
+// longest period, in samples, that is generated once and then tiled
+#define AUDIO_PERIOD_MAX 4096
+
+static inline u64 audio_gcd(u64 a, u64 b) {
+	while (b != 0) {
+		u64 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
 #if defined(RESAMPLE_BANDLIMITED)
 #include "math.h"
 
+#ifndef AVOID_MALLOC
+#include <stdatomic.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#define AUDIO_WAVETABLE_CACHE
+// 32 tables of (1 << TRIG_SHIFT) samples = ~1.1 MB per generating thread
+#define AUDIO_WAVETABLE_CACHE_SIZE 32
+#endif
+
 #ifndef M_PI
 #define M_PI 3.14159265358979
 #endif
@@ -50,17 +72,12 @@ void audio_generate_init(void) {
 	}
 }
 
-u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
-#if 1
-	// fixed-point
+// Returns the sample at the given cosine table index, in the .14 range.
+static inline s32 audio_generate_bandlimited(int freq_real_fixed, u32 cos_indice, int freq_aud) {
 	s32 sample = 0;
 	int coeff_pos = 1;
-
-	int freq_real_fixed = (int) (freq_real * (1 << 6));
 	int pos = freq_real_fixed;
 
-	u64 cos_indice = ((u64) freq_real_fixed * pos_fixed / freq_aud);
-
 	while (pos < (freq_aud << (6 - 1)) && coeff_pos < COEFF_MAX) {
 		// -(1 << 28) = 0
 		// (1 << 28) = 1
@@ -70,13 +87,26 @@ u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, in
 		coeff_pos++;
 	}
 
-	// sample = 0..1 in the .28 range
-	sample = ((((sample >> 14) + (1 << 14)) * (max - min)) >> 15) + min;
+	return sample >> 14;
+}
+
+static inline u16 audio_scale_bandlimited(s32 value, u16 min, u16 max) {
+	// value = 0..1 in the .15 range
+	s32 sample = (((value + (1 << 14)) * (max - min)) >> 15) + min;
 
 	if (sample < min) sample = min;
 	else if (sample > max) sample = max;
 
 	return (u16) sample;
+}
+
+u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+#if 1
+	// fixed-point
+	int freq_real_fixed = (int) (freq_real * (1 << 6));
+	u64 cos_indice = ((u64) freq_real_fixed * pos_fixed / freq_aud);
+
+	return audio_scale_bandlimited(audio_generate_bandlimited(freq_real_fixed, cos_indice & ((1 << TRIG_SHIFT) - 1), freq_aud), min, max);
 #else
 	// floating-point/reference
 	float sample = 0.0f;
@@ -104,6 +134,253 @@ u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, in
 	return (u16) sample;
 #endif
 }
+
+// The sample only depends on the cosine table index, which repeats exactly
+// once (freq_real_fixed * 256 * period) is a multiple of (freq_aud << TRIG_SHIFT).
+static int audio_generate_period(int freq_fixed, double freq_real, int freq_aud) {
+	(void) freq_fixed;
+	u64 step = (u64) ((int) (freq_real * (1 << 6))) << 8;
+	u64 wrap = (u64) freq_aud << TRIG_SHIFT;
+	if (step == 0) return 0;
+	u64 period = wrap / audio_gcd(step, wrap);
+	return period <= AUDIO_PERIOD_MAX ? (int) period : 0;
+}
+
+#ifdef AUDIO_WAVETABLE_CACHE
+// One period of the waveform at the cosine table's phase resolution, filled
+// in lazily. The waveform only depends on freq_real_fixed (which maps 1:1 to
+// the PIT divisor for audible notes) and the output rate, so those form the
+// key; volume is applied afterwards.
+typedef struct {
+	int freq_real_fixed; // 0 = unused
+	int freq_aud;
+	u32 last_used;
+	s16 *values;
+	u8 *filled;
+} audio_wavetable;
+
+typedef struct {
+	audio_wavetable tables[AUDIO_WAVETABLE_CACHE_SIZE];
+	u32 clock;
+} audio_wavetable_cache;
+
+// one cache per generating thread (audio callback, writers)
+static _Thread_local audio_wavetable_cache *wavetable_cache;
+static atomic_ullong wavetable_lookups, wavetable_hits, wavetable_evictions;
+static atomic_ullong wavetable_samples, wavetable_samples_generated;
+
+static void audio_wavetable_cache_free(void *ptr) {
+	audio_wavetable_cache *cache = ptr;
+	if (cache == NULL) return;
+	for (int i = 0; i < AUDIO_WAVETABLE_CACHE_SIZE; i++) {
+		free(cache->tables[i].values);
+		free(cache->tables[i].filled);
+	}
+	free(cache);
+}
+
+#ifdef HAVE_PTHREAD
+// releases the cache of threads which exit without calling
+// audio_wavetable_free_thread(), such as audio device callback threads
+static pthread_key_t wavetable_cache_key;
+static pthread_once_t wavetable_cache_key_once = PTHREAD_ONCE_INIT;
+static bool wavetable_cache_key_valid;
+
+static void audio_wavetable_key_init(void) {
+	wavetable_cache_key_valid = pthread_key_create(&wavetable_cache_key, audio_wavetable_cache_free) == 0;
+}
+#endif
+
+void audio_wavetable_free_thread(void) {
+#ifdef HAVE_PTHREAD
+	if (wavetable_cache != NULL && wavetable_cache_key_valid) {
+		pthread_setspecific(wavetable_cache_key, NULL);
+	}
+#endif
+	audio_wavetable_cache_free(wavetable_cache);
+	wavetable_cache = NULL;
+}
+
+static audio_wavetable *audio_wavetable_get(int freq_real_fixed, int freq_aud) {
+	audio_wavetable_cache *cache = wavetable_cache;
+	audio_wavetable *lru;
+
+	if (cache == NULL) {
+		cache = wavetable_cache = calloc(1, sizeof(audio_wavetable_cache));
+		if (cache == NULL) return NULL;
+#ifdef HAVE_PTHREAD
+		pthread_once(&wavetable_cache_key_once, audio_wavetable_key_init);
+		if (wavetable_cache_key_valid) {
+			pthread_setspecific(wavetable_cache_key, cache);
+		}
+#endif
+	}
+
+	atomic_fetch_add_explicit(&wavetable_lookups, 1, memory_order_relaxed);
+	cache->clock++;
+	lru = &cache->tables[0];
+	for (int i = 0; i < AUDIO_WAVETABLE_CACHE_SIZE; i++) {
+		audio_wavetable *t = &cache->tables[i];
+		if (t->values != NULL && t->freq_real_fixed == freq_real_fixed && t->freq_aud == freq_aud) {
+			atomic_fetch_add_explicit(&wavetable_hits, 1, memory_order_relaxed);
+			t->last_used = cache->clock;
+			return t;
+		}
+		if (t->last_used < lru->last_used) lru = t;
+	}
+
+	if (lru->values == NULL) {
+		lru->values = malloc(sizeof(s16) << TRIG_SHIFT);
+		lru->filled = malloc((1 << TRIG_SHIFT) >> 3);
+		if (lru->values == NULL || lru->filled == NULL) {
+			free(lru->values);
+			free(lru->filled);
+			lru->values = NULL;
+			lru->filled = NULL;
+			return NULL;
+		}
+	} else {
+		atomic_fetch_add_explicit(&wavetable_evictions, 1, memory_order_relaxed);
+	}
+
+	memset(lru->filled, 0, (1 << TRIG_SHIFT) >> 3);
+	lru->freq_real_fixed = freq_real_fixed;
+	lru->freq_aud = freq_aud;
+	lru->last_used = cache->clock;
+	return lru;
+}
+
+void audio_wavetable_get_stats(audio_wavetable_stats *stats) {
+	stats->lookups = atomic_load(&wavetable_lookups);
+	stats->hits = atomic_load(&wavetable_hits);
+	stats->evictions = atomic_load(&wavetable_evictions);
+	stats->samples = atomic_load(&wavetable_samples);
+	stats->samples_generated = atomic_load(&wavetable_samples_generated);
+}
+
+static void audio_generate_direct(u16 *out, int len, u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+	int freq_real_fixed = (int) (freq_real * (1 << 6));
+	audio_wavetable *table = audio_wavetable_get(freq_real_fixed, freq_aud);
+	int generated = 0;
+
+	if (table == NULL) {
+		for (int i = 0; i < len; i++, pos_fixed += 256) {
+			out[i] = audio_generate_sample(min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+		}
+		return;
+	}
+
+	for (int i = 0; i < len; i++, pos_fixed += 256) {
+		u32 cos_indice = ((u64) freq_real_fixed * pos_fixed / freq_aud) & ((1 << TRIG_SHIFT) - 1);
+		if (!(table->filled[cos_indice >> 3] & (1 << (cos_indice & 7)))) {
+			table->values[cos_indice] = audio_generate_bandlimited(freq_real_fixed, cos_indice, freq_aud);
+			table->filled[cos_indice >> 3] |= (1 << (cos_indice & 7));
+			generated++;
+		}
+		out[i] = audio_scale_bandlimited(table->values[cos_indice], min, max);
+	}
+
+	atomic_fetch_add_explicit(&wavetable_samples, len, memory_order_relaxed);
+	atomic_fetch_add_explicit(&wavetable_samples_generated, generated, memory_order_relaxed);
+}
+#else
+static void audio_generate_direct(u16 *out, int len, u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+	for (int i = 0; i < len; i++, pos_fixed += 256) {
+		out[i] = audio_generate_sample(min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+	}
+}
+#endif
+#elif defined(RESAMPLE_BLEP)
+#include "math.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+// Band-limited steps: the naive square wave is corrected around each edge
+// with a windowed-sinc step residual. Only edges within BLEP_WIDTH samples
+// contribute, so the cost per sample does not depend on the harmonic count.
+#define BLEP_WIDTH 8
+#define BLEP_OVERSAMPLE 128
+#define BLEP_CUTOFF 0.45
+#define BLEP_TABLE_LEN (BLEP_WIDTH * 2 * BLEP_OVERSAMPLE + 2)
+
+static float blep_table[BLEP_TABLE_LEN];
+
+void audio_generate_init(void) {
+	double sum = 0.0;
+	double prev = 0.0;
+	double step[BLEP_TABLE_LEN];
+
+	// integrate a Blackman-windowed sinc over [-BLEP_WIDTH, BLEP_WIDTH]
+	for (int i = 0; i < BLEP_TABLE_LEN; i++) {
+		double x = (i / (double) BLEP_OVERSAMPLE) - BLEP_WIDTH;
+		double w = (x < BLEP_WIDTH) ? (0.42 + 0.5 * cos(M_PI * x / BLEP_WIDTH) + 0.08 * cos(2 * M_PI * x / BLEP_WIDTH)) : 0.0;
+		double sinc = (x == 0.0) ? 1.0 : sin(2 * M_PI * BLEP_CUTOFF * x) / (2 * M_PI * BLEP_CUTOFF * x);
+		double curr = sinc * w;
+		sum += (prev + curr) * 0.5;
+		prev = curr;
+		step[i] = sum;
+	}
+
+	for (int i = 0; i < BLEP_TABLE_LEN; i++) {
+		blep_table[i] = step[i] / sum;
+	}
+}
+
+// band-limited step at x samples after the edge, minus the ideal step
+static inline double audio_blep_residual(double x, bool after) {
+	double pos = (x + BLEP_WIDTH) * BLEP_OVERSAMPLE;
+	int i = (int) pos;
+	double frac = pos - i;
+	double v = blep_table[i] + (blep_table[i + 1] - blep_table[i]) * frac;
+	return after ? (v - 1.0) : v;
+}
+
+u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+	// at or above Nyquist, nothing audible remains
+	double half_period = freq_aud / (freq_real * 2);
+	if (half_period <= 1.0) {
+		return (max + min) >> 1;
+	}
+
+	// time since the last rising edge, in samples
+	double since_rise = fmod(pos_fixed / 256.0, half_period * 2);
+	double v = (since_rise < half_period) ? 1.0 : -1.0;
+
+	// edges at (j * half_period - since_rise) samples from now; even j rise, odd j fall
+	for (int j = (int) ceil((since_rise - BLEP_WIDTH) / half_period);; j++) {
+		double x = j * half_period - since_rise;
+		if (x >= BLEP_WIDTH) break;
+		if (x <= -BLEP_WIDTH) continue;
+		double r = audio_blep_residual(-x, x <= 0.0);
+		v += (j & 1) ? (r * -2.0) : (r * 2.0);
+	}
+
+	// same level as the other resamplers; the edge overshoot is clamped
+	int sample = (int) ((v + 1.0) * 0.5 * (max - min)) + min;
+
+	if (sample < min) sample = min;
+	else if (sample > max) sample = max;
+
+	return (u16) sample;
+}
+
+// Only tiled when the period is a whole number of samples; anything else
+// would not line up at the seam.
+static int audio_generate_period(int freq_fixed, double freq_real, int freq_aud) {
+	(void) freq_fixed;
+	double period = freq_aud / freq_real;
+	int period_int = (int) (period + 0.5);
+	if (period_int <= 1 || period_int > AUDIO_PERIOD_MAX || fabs(period - period_int) > 1e-9) return 0;
+	return period_int;
+}
+
+static void audio_generate_direct(u16 *out, int len, u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+	for (int i = 0; i < len; i++, pos_fixed += 256) {
+		out[i] = audio_generate_sample(min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+	}
+}
 #else
 void audio_generate_init(void) {
 
@@ -145,8 +422,77 @@ u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, in
 	// huh
 	return (max + min) >> 1;
 }
+
+// pos_fixed advances by 256 per sample and wraps every (freq_fixed << 1).
+static int audio_generate_period(int freq_fixed, double freq_real, int freq_aud) {
+	(void) freq_real;
+	(void) freq_aud;
+	int wrap = freq_fixed << 1;
+	if (wrap <= 0) return 0;
+	int period = wrap / (int) audio_gcd(wrap, 256);
+	return period <= AUDIO_PERIOD_MAX ? period : 0;
+}
+
+// The output only changes at the edges (and, for linear, on the sample
+// right after each edge), so everything in between is a constant run.
+static void audio_generate_direct(u16 *out, int len, u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+	int wrap = freq_fixed << 1;
+	int i = 0;
+
+	if (wrap <= 0) {
+		for (; i < len; i++, pos_fixed += 256) {
+			out[i] = audio_generate_sample(min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+		}
+		return;
+	}
+
+	pos_fixed %= wrap;
+	while (i < len) {
+		int edge = (pos_fixed < freq_fixed) ? freq_fixed : wrap;
+		int run = 1;
+#if defined(RESAMPLE_LINEAR)
+		int since_edge = (pos_fixed < freq_fixed) ? pos_fixed : (pos_fixed - freq_fixed);
+		if (since_edge >= 256)
+#endif
+		run = (edge - pos_fixed + 255) >> 8;
+		if (run > len - i) run = len - i;
+
+		u16 v = audio_generate_sample(min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+		for (int j = 0; j < run; j++) {
+			out[i + j] = v;
+		}
+		i += run;
+		pos_fixed += run << 8;
+		if (pos_fixed >= wrap) pos_fixed -= wrap;
+	}
+}
 #endif
 
+#ifndef AUDIO_WAVETABLE_CACHE
+void audio_wavetable_get_stats(audio_wavetable_stats *stats) {
+	memset(stats, 0, sizeof(audio_wavetable_stats));
+}
+
+void audio_wavetable_free_thread(void) {
+}
+#endif
+
+void audio_generate_samples(u16 *out, int len, u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud) {
+	int period = audio_generate_period(freq_fixed, freq_real, freq_aud);
+	if (period <= 0 || period * 2 > len) {
+		audio_generate_direct(out, len, min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+		return;
+	}
+
+	// generate one period, then tile it by doubling the copied span
+	audio_generate_direct(out, period, min, max, freq_fixed, freq_real, pos_fixed, freq_aud);
+	for (int i = period; i < len;) {
+		int n = (i < len - i) ? i : (len - i);
+		memcpy(out + i, out, n * sizeof(u16));
+		i += n;
+	}
+}
+
 static double audio_delay_time = 1.0;
 static bool audio_remove_player_movement_sound = true;
 
@@ -27,6 +27,14 @@
 
 #define MINIMUM_NOTE_DELAY 2
 
+typedef struct {
+	u64 lookups; // one per generated note span
+	u64 hits;
+	u64 evictions;
+	u64 samples; // samples served from the cache
+	u64 samples_generated; // of which had to be synthesized first
+} audio_wavetable_stats;
+
 typedef struct {
 	u8 enabled;
 	int cycles;
@@ -36,6 +44,12 @@ typedef struct {
 
 void audio_generate_init(void);
 u16 audio_generate_sample(u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud);
+// same as calling audio_generate_sample for len samples, pos_fixed advancing by 256
+void audio_generate_samples(u16 *out, int len, u16 min, u16 max, int freq_fixed, double freq_real, int pos_fixed, int freq_aud);
+// bandlimited wavetable cache counters, summed over all threads (zero in other modes)
+void audio_wavetable_get_stats(audio_wavetable_stats *stats);
+// release the calling thread's wavetable cache; it is rebuilt on demand
+void audio_wavetable_free_thread(void);
 
 USER_FUNCTION
 double audio_get_note_delay();
@@ -20,9 +20,11 @@
  * SOFTWARE.
  */
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "audio_shared.h"
 #include "audio_stream.h"
 #include "logging.h"
@@ -32,30 +34,81 @@
 #endif
 
 #define AUDIO_VOLUME_MAX 127
-static u8 speaker_overrun_flagged = 0;
-static long speaker_freq_ctr = 0;
-static u8 audio_volume = 0;
-static double audio_prev_time;
-static int audio_freq;
-static bool audio_signed;
-static bool audio_16bit;
-
 #define DEFAULT_SPEAKER_ENTRY_LEN 128
-static int speaker_entry_pos = 0;
+
+// Speaker events travel from the emulator thread (producer) to the audio
+// thread (consumer) through a lock-free single-producer/single-consumer
+// ring; the consumer moves them into speaker_entries before generating.
+// Neither side ever waits for the other - a full ring drops the event.
+#define SPEAKER_RING_LEN 1024
+
+// The audio device clock and the emulator clock drift apart, and callbacks
+// arrive with jitter. Rather than jumping the stream's timeline whenever it
+// falls behind, the timeline is advanced slightly faster or slower than
+// real time (by at most AUDIO_STREAM_RATIO_MAX) to absorb the smoothed
+// drift over roughly AUDIO_STREAM_CATCHUP_MS. Only drift larger than both
+// AUDIO_STREAM_RESYNC_MS and four buffers' worth causes a hard resync.
+#define AUDIO_STREAM_DRIFT_SMOOTHING (1.0 / 16)
+#define AUDIO_STREAM_CATCHUP_MS 500.0
+#define AUDIO_STREAM_RATIO_MAX 0.02
+#define AUDIO_STREAM_RESYNC_MS 100.0
+// buffer enough audio to cover this many times the measured jitter, but
+// never more than this many device requests' worth
+#define AUDIO_STREAM_JITTER_MARGIN 4
+#define AUDIO_STREAM_TARGET_MAX_BUFFERS 4
+
+struct s_audio_stream_state {
+	atomic_bool speaker_overrun_flagged;
+	long speaker_freq_ctr;
+	u8 volume;
+	double prev_time;
+	double drift_avg; // ms, smoothed
+	double jitter_avg; // ms, smoothed absolute deviation from drift_avg
+	int freq;
+	bool asigned;
+	bool a16bit;
+
+	int speaker_entry_pos;
 #ifdef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
 #define SPEAKER_ENTRY_LEN DEFAULT_SPEAKER_ENTRY_LEN
-static speaker_entry speaker_entries[SPEAKER_ENTRY_LEN];
+	speaker_entry speaker_entries[SPEAKER_ENTRY_LEN];
 #else
-static speaker_entry *speaker_entries;
-static int speaker_entry_len = 0;
+	speaker_entry *speaker_entries;
+	int speaker_entry_len;
 #endif
 
+	speaker_entry speaker_ring[SPEAKER_RING_LEN];
+	atomic_uint speaker_ring_head; // written by the producer only
+	atomic_uint speaker_ring_tail; // written by the consumer only
+
+	// producer-side copy of the most recent events, for note timing
+	speaker_entry speaker_history[3];
+	int speaker_history_len;
+
+	// statistics; written with relaxed atomics so that they can be read
+	// from any thread without tearing
+	atomic_ullong stat_callbacks;
+	atomic_ullong stat_callback_us_total;
+	atomic_ullong stat_callback_us_max;
+	atomic_ullong stat_entries;
+	atomic_ullong stat_entries_max;
+	atomic_ullong stat_overruns;
+	atomic_ullong stat_entries_dropped;
+	atomic_llong stat_drift_us;
+	atomic_ullong stat_drift_us_max;
+	atomic_ullong stat_jitter_us;
+	atomic_llong stat_ratio_ppm;
+	atomic_ullong stat_resyncs;
+};
+
+// the instance behind the audio_stream_* functions used by the frontends
+static audio_stream_state default_stream;
+
 // #define AUDIO_STREAM_DEBUG
 // #define AUDIO_STREAM_DEBUG_BUFFERS
 
 #ifdef AUDIO_STREAM_DEBUG
-static void audio_stream_print(int pos) {
-	speaker_entry *e = &speaker_entries[pos];
+static void audio_stream_print(speaker_entry *e) {
 	if (e->enabled) {
 		fprintf(stderr, "[%.2f cpu: %d] speaker on @ %.2f Hz\n", e->ms, e->cycles, e->freq);
 	} else {
@@ -65,9 +118,9 @@ static void audio_stream_print(int pos) {
 #endif
 
 #ifdef AUDIO_STREAM_DEBUG_BUFFERS
-static void audio_stream_print_all_entries(void) {
-	for (int i = 0; i < speaker_entry_pos; i++) {
-		speaker_entry *e = &speaker_entries[i];
+static void audio_stream_print_all_entries(audio_stream_state *s) {
+	for (int i = 0; i < s->speaker_entry_pos; i++) {
+		speaker_entry *e = &s->speaker_entries[i];
 		if (e->enabled) {
 			fprintf(stderr, "buffer[%d]: %.2f ms / on @ %.2f Hz\n", i, e->ms, e->freq);
 		} else {
@@ -77,23 +130,99 @@ static void audio_stream_print_all_entries(void) {
 }
 #endif
 
-static void audio_stream_flag_speaker_overrun(void) {
-	if (!speaker_overrun_flagged) {
+static void audio_stream_flag_speaker_overrun(audio_stream_state *s) {
+	atomic_fetch_add_explicit(&s->stat_entries_dropped, 1, memory_order_relaxed);
+	if (!atomic_exchange(&s->speaker_overrun_flagged, true)) {
+		atomic_fetch_add_explicit(&s->stat_overruns, 1, memory_order_relaxed);
 		fprintf(stderr, "speaker buffer overrun!\n");
-		speaker_overrun_flagged = 1;
 	}
 }
 
+static u64 audio_stream_time_us(void) {
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (u64) spec.tv_sec * 1000000 + (spec.tv_nsec / 1000);
+}
+
+// Only the consumer writes these, so a plain load/store pair suffices.
+static inline void audio_stream_stat_add(atomic_ullong *stat, u64 value) {
+	atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void audio_stream_stat_max(atomic_ullong *stat, u64 value) {
+	if (value > atomic_load_explicit(stat, memory_order_relaxed)) {
+		atomic_store_explicit(stat, value, memory_order_relaxed);
+	}
+}
+
+void audio_stream_state_get_stats(audio_stream_state *s, audio_stream_stats *stats) {
+	stats->callbacks = atomic_load_explicit(&s->stat_callbacks, memory_order_relaxed);
+	stats->callback_us_total = atomic_load_explicit(&s->stat_callback_us_total, memory_order_relaxed);
+	stats->callback_us_max = atomic_load_explicit(&s->stat_callback_us_max, memory_order_relaxed);
+	stats->entries = atomic_load_explicit(&s->stat_entries, memory_order_relaxed);
+	stats->entries_max = atomic_load_explicit(&s->stat_entries_max, memory_order_relaxed);
+	stats->overruns = atomic_load_explicit(&s->stat_overruns, memory_order_relaxed);
+	stats->entries_dropped = atomic_load_explicit(&s->stat_entries_dropped, memory_order_relaxed);
+	stats->drift_us = atomic_load_explicit(&s->stat_drift_us, memory_order_relaxed);
+	stats->drift_us_max = atomic_load_explicit(&s->stat_drift_us_max, memory_order_relaxed);
+	stats->jitter_us = atomic_load_explicit(&s->stat_jitter_us, memory_order_relaxed);
+	stats->ratio_ppm = atomic_load_explicit(&s->stat_ratio_ppm, memory_order_relaxed);
+	stats->resyncs = atomic_load_explicit(&s->stat_resyncs, memory_order_relaxed);
+}
+
+void audio_stream_get_stats(audio_stream_stats *stats) {
+	audio_stream_state_get_stats(&default_stream, stats);
+}
+
+static void audio_stream_state_init(audio_stream_state *s, int freq, bool asigned, bool a16bit) {
+	atomic_store(&s->speaker_overrun_flagged, false);
+	s->speaker_freq_ctr = 0;
+	s->prev_time = -1;
+	s->drift_avg = 0;
+	s->jitter_avg = 0;
+	s->freq = freq;
+	s->asigned = asigned;
+	s->a16bit = a16bit;
+}
+
+#ifndef AVOID_MALLOC
+audio_stream_state *audio_stream_create(int freq, bool asigned, bool a16bit) {
+	audio_stream_state *s = calloc(1, sizeof(audio_stream_state));
+	if (s == NULL) {
+		return NULL;
+	}
+	atomic_init(&s->speaker_ring_head, 0);
+	atomic_init(&s->speaker_ring_tail, 0);
+	audio_stream_state_init(s, freq, asigned, a16bit);
+	return s;
+}
+
+void audio_stream_free(audio_stream_state *s) {
+	if (s == NULL) {
+		return;
+	}
+#ifndef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
+	free(s->speaker_entries);
+#endif
+	free(s);
+}
+#endif
+
 void audio_stream_init(long time, int freq, bool asigned, bool a16bit) {
-	speaker_overrun_flagged = 0;
-	audio_prev_time = -1;
-	audio_freq = freq;
-	audio_signed = asigned;
-	audio_16bit = a16bit;
+	audio_stream_state_init(&default_stream, freq, asigned, a16bit);
+}
+
+u8 audio_stream_state_get_volume(audio_stream_state *s) {
+	return s->volume;
+}
+
+void audio_stream_state_set_volume(audio_stream_state *s, u8 volume) {
+	if (volume > AUDIO_VOLUME_MAX) volume = AUDIO_VOLUME_MAX;
+	s->volume = volume;
 }
 
 u8 audio_stream_get_volume() {
-	return audio_volume;
+	return audio_stream_state_get_volume(&default_stream);
 }
 
 u8 audio_stream_get_max_volume() {
@@ -101,14 +230,13 @@ u8 audio_stream_get_max_volume() {
 }
 
 void audio_stream_set_volume(u8 volume) {
-	if (volume > AUDIO_VOLUME_MAX) volume = AUDIO_VOLUME_MAX;
-	audio_volume = volume;
+	audio_stream_state_set_volume(&default_stream, volume);
 }
 
-static inline void audio_stream_clear(u8 *stream, u16 audio_smp_center, long audio_from, long audio_to) {
+static inline void audio_stream_clear(audio_stream_state *s, u8 *stream, u16 audio_smp_center, long audio_from, long audio_to) {
 	long j;
 	u16* stream16 = (u16*) stream;
-	if (audio_16bit) {
+	if (s->a16bit) {
 		for (j = audio_from; j < audio_to; j++) {
 			stream16[j] = audio_smp_center;
 		}
@@ -117,68 +245,180 @@ static inline void audio_stream_clear(u8 *stream, u16 audio_smp_center, long aud
 	}
 }
 
-void audio_stream_generate(long time, u8 *stream, int len) {
-	int i; long j;
+#ifndef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
+static bool audio_stream_ensure_size(audio_stream_state *s, int len) {
+	int old_speaker_len = s->speaker_entry_len;
+	speaker_entry *old_speaker_entries = s->speaker_entries;
+
+	if (s->speaker_entry_len == 0) {
+		s->speaker_entries = malloc(sizeof(speaker_entry) * DEFAULT_SPEAKER_ENTRY_LEN);
+		if (s->speaker_entries == NULL) {
+			return false;
+		}
+		s->speaker_entry_len = DEFAULT_SPEAKER_ENTRY_LEN;
+	} else if (len > s->speaker_entry_len) {
+		while (len > s->speaker_entry_len) {
+			s->speaker_entry_len *= 2;
+		}
+		fprintf(stderr, "speaker buffer overrun! scaling (%d -> %d)\n", old_speaker_len, s->speaker_entry_len);
+		s->speaker_entries = realloc(s->speaker_entries, sizeof(speaker_entry) * s->speaker_entry_len);
+		if (s->speaker_entries == NULL) {
+			s->speaker_entry_len = old_speaker_len;
+			s->speaker_entries = old_speaker_entries;
+			return false;
+		}
+	}
+
+	return true;
+}
+#endif
+
+// Consumer: move queued events from the ring into speaker_entries.
+static void audio_stream_receive(audio_stream_state *s) {
+	unsigned int tail = atomic_load_explicit(&s->speaker_ring_tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&s->speaker_ring_head, memory_order_acquire);
+
+	while (tail != head) {
+#ifdef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
+		if (s->speaker_entry_pos >= SPEAKER_ENTRY_LEN) break;
+#else
+		if (!audio_stream_ensure_size(s, s->speaker_entry_pos + 1)) break;
+#endif
+		speaker_entry *e = &s->speaker_entries[s->speaker_entry_pos++];
+		*e = s->speaker_ring[tail & (SPEAKER_RING_LEN - 1)];
+		if (!e->enabled && e->ms < s->prev_time) {
+			e->ms = s->prev_time;
+		}
+		tail++;
+	}
+
+	atomic_store_explicit(&s->speaker_ring_tail, tail, memory_order_release);
+}
+
+#define AUDIO_STREAM_CHUNK_LEN 1024
+
+static void audio_stream_emit_note(audio_stream_state *s, u8 *stream, long audio_from, long audio_to, u16 audio_smp_min, u16 audio_smp_max, int freq_fixed, double freq, int pos_fixed) {
+	long j;
+
+	if (s->a16bit) {
+		u16* stream16 = ((u16*) stream) + audio_from;
+		long len = audio_to - audio_from;
+		audio_generate_samples(stream16, len, audio_smp_min, audio_smp_max, freq_fixed, freq, pos_fixed, s->freq);
+		if (s->asigned) {
+			for (j = 0; j < len; j++) {
+				stream16[j] ^= 0x8000;
+			}
+		}
+	} else {
+		u16 chunk[AUDIO_STREAM_CHUNK_LEN];
+		u8 xor = s->asigned ? 0x80 : 0x00;
+		while (audio_from < audio_to) {
+			long len = audio_to - audio_from;
+			if (len > AUDIO_STREAM_CHUNK_LEN) len = AUDIO_STREAM_CHUNK_LEN;
+			audio_generate_samples(chunk, len, audio_smp_min, audio_smp_max, freq_fixed, freq, pos_fixed, s->freq);
+			for (j = 0; j < len; j++) {
+				stream[audio_from + j] = chunk[j] ^ xor;
+			}
+			audio_from += len;
+			pos_fixed += len << 8;
+		}
+	}
+}
+
+static void audio_stream_generate_inner(audio_stream_state *s, long time, u8 *stream, int len) {
+	int i;
 	int freq_samples_fixed;
 	int pos_samples_fixed;
 	int k, note_played = 0;
 	double audio_res;
+	double audio_drift, audio_ratio, audio_resync_ms;
 	double audio_curr_time;
 	double res_to_samples;
 	double audio_dfrom, audio_dto;
 	long audio_from, audio_to, audio_last_to = -(1 << 30);
-	u16* stream16 = (u16*) stream;
+	speaker_entry *speaker_entries;
 
-	u16 audio_smp_min = (128 - audio_volume);
-	u16 audio_smp_max = (128 + audio_volume);
-	u16 audio_smp_center = audio_signed ? 0 : 128;
+	u16 audio_smp_min = (128 - s->volume);
+	u16 audio_smp_max = (128 + s->volume);
+	u16 audio_smp_center = s->asigned ? 0 : 128;
 
-	if (audio_16bit) {
+	if (s->a16bit) {
 		audio_smp_min <<= 8;
 		audio_smp_max <<= 8;
 		audio_smp_center <<= 8;
 		len >>= 1;
 	}
 
-	audio_res = (len / (double) audio_freq * 1000);
-	audio_curr_time = audio_prev_time + audio_res;
-//	audio_curr_time = time;
-	res_to_samples = len / audio_res;
+	audio_res = (len / (double) s->freq * 1000);
+
+	audio_stream_receive(s);
+	speaker_entries = s->speaker_entries;
 
 	// handle the first
-	if (audio_prev_time < 0) {
-		audio_prev_time = time;
-		audio_stream_clear(stream, audio_smp_center, 0, len);
-		speaker_entry_pos = 0;
+	if (s->prev_time < 0) {
+		s->prev_time = time;
+		audio_stream_clear(s, stream, audio_smp_center, 0, len);
+		s->speaker_entry_pos = 0;
 		return;
 	}
 
-	if (audio_curr_time < time) {
-		audio_curr_time = time;
+	// measure drift against where the stream expects to be, then pick
+	// the timeline rate for this buffer
+	audio_drift = time - (s->prev_time + audio_res);
+	audio_resync_ms = audio_res * 4;
+	if (audio_resync_ms < AUDIO_STREAM_RESYNC_MS) audio_resync_ms = AUDIO_STREAM_RESYNC_MS;
+	if (audio_drift > audio_resync_ms || audio_drift < -audio_resync_ms) {
+		// too far off to slew; jump, as the stream used to
+		s->prev_time = time - audio_res;
+		s->drift_avg = 0;
+		// the stall which caused this says nothing about regular jitter
+		s->jitter_avg = 0;
+		audio_stream_stat_add(&s->stat_resyncs, 1);
+		audio_ratio = 1.0;
+	} else {
+		double deviation = audio_drift - s->drift_avg;
+		s->drift_avg += (audio_drift - s->drift_avg) * AUDIO_STREAM_DRIFT_SMOOTHING;
+		s->jitter_avg += ((deviation < 0 ? -deviation : deviation) - s->jitter_avg) * AUDIO_STREAM_DRIFT_SMOOTHING;
+		audio_ratio = 1.0 + (s->drift_avg / AUDIO_STREAM_CATCHUP_MS);
+		if (audio_ratio > 1.0 + AUDIO_STREAM_RATIO_MAX) audio_ratio = 1.0 + AUDIO_STREAM_RATIO_MAX;
+		else if (audio_ratio < 1.0 - AUDIO_STREAM_RATIO_MAX) audio_ratio = 1.0 - AUDIO_STREAM_RATIO_MAX;
+	}
+	audio_res *= audio_ratio;
+	audio_curr_time = s->prev_time + audio_res;
+	res_to_samples = len / audio_res;
+
+	{
+		s64 drift_us = (s64) (audio_drift * 1000.0);
+		atomic_store_explicit(&s->stat_drift_us, drift_us, memory_order_relaxed);
+		audio_stream_stat_max(&s->stat_drift_us_max, drift_us < 0 ? -drift_us : drift_us);
+		atomic_store_explicit(&s->stat_jitter_us, (u64) (s->jitter_avg * 1000.0), memory_order_relaxed);
+		atomic_store_explicit(&s->stat_ratio_ppm, (s64) ((audio_ratio - 1.0) * 1000000.0), memory_order_relaxed);
+		audio_stream_stat_add(&s->stat_entries, s->speaker_entry_pos);
+		audio_stream_stat_max(&s->stat_entries_max, s->speaker_entry_pos);
 	}
 
 #ifdef AUDIO_STREAM_DEBUG
-	fprintf(stderr, "[callback] expected time %.2f received time %ld drift %.2f buffer size %d\n", audio_curr_time, time, time - audio_curr_time, speaker_entry_pos);
+	fprintf(stderr, "[callback] expected time %.2f received time %ld drift %.2f buffer size %d\n", audio_curr_time, time, time - audio_curr_time, s->speaker_entry_pos);
 #endif
 
 #ifdef AUDIO_STREAM_DEBUG_BUFFERS
-	fprintf(stderr, "[callback] buffer state BEFORE (%d)\n", speaker_entry_pos);
-	audio_stream_print_all_entries();
+	fprintf(stderr, "[callback] buffer state BEFORE (%d)\n", s->speaker_entry_pos);
+	audio_stream_print_all_entries(s);
 #endif
 
-	if (speaker_entry_pos == 0) {
+	if (s->speaker_entry_pos == 0) {
 		audio_curr_time = time;
-		audio_stream_clear(stream, audio_smp_center, 0, len);
+		audio_stream_clear(s, stream, audio_smp_center, 0, len);
 	} else {
-		for (i = 0; i < speaker_entry_pos; i++) {
+		for (i = 0; i < s->speaker_entry_pos; i++) {
 			// audio_dfrom/to = duration relative to the beginning of stream (ms)
-			audio_dfrom = speaker_entries[i].ms - audio_prev_time;
-			if (i == speaker_entry_pos - 1) {
+			audio_dfrom = speaker_entries[i].ms - s->prev_time;
+			if (i == s->speaker_entry_pos - 1) {
 				#ifdef AUDIO_STREAM_DEBUG
 				fprintf(stderr, "[callback] guessing next sample length\n");
 				#endif
 				audio_dto = audio_res;
-			} else audio_dto = speaker_entries[i+1].ms - audio_prev_time;
+			} else audio_dto = speaker_entries[i+1].ms - s->prev_time;
 
 			// audio_from/to = duration relative to the beginning of stream (samples)
 			audio_from = (long) (audio_dfrom * res_to_samples);
@@ -200,7 +440,7 @@ void audio_stream_generate(long time, u8 *stream, int len) {
 
                        // If first note and above 0, memset.
 			if (i == 0 && audio_from > 0) {
-				audio_stream_clear(stream, audio_smp_center, 0, audio_from < len ? audio_from : len);
+				audio_stream_clear(s, stream, audio_smp_center, 0, audio_from < len ? audio_from : len);
 			}
 
 			// Clamp; if out of bounds, skip note.
@@ -219,40 +459,17 @@ void audio_stream_generate(long time, u8 *stream, int len) {
 					#ifdef AUDIO_STREAM_DEBUG
 					fprintf(stderr, "[callback] emitting note @ %.2f Hz (%ld, %ld)\n", speaker_entries[i].freq, audio_from, audio_to);
 					#endif
-					freq_samples_fixed = (int) ((audio_freq << 8) / (speaker_entries[i].freq * 2));
-					pos_samples_fixed = (speaker_freq_ctr << 8);
-					if (audio_signed) {
-						if (audio_16bit) {
-							for (j = audio_from; j < audio_to; j++) {
-								stream16[j] = audio_generate_sample(audio_smp_min, audio_smp_max, freq_samples_fixed, speaker_entries[i].freq, pos_samples_fixed, audio_freq) ^ 0x8000;
-								pos_samples_fixed += 256;
-							}
-						} else {
-							for (j = audio_from; j < audio_to; j++) {
-								stream[j] = audio_generate_sample(audio_smp_min, audio_smp_max, freq_samples_fixed, speaker_entries[i].freq, pos_samples_fixed, audio_freq) ^ 0x80;
-								pos_samples_fixed += 256;
-							}
-						}
-					} else {
-						if (audio_16bit) {
-							for (j = audio_from; j < audio_to; j++) {
-								stream16[j] = audio_generate_sample(audio_smp_min, audio_smp_max, freq_samples_fixed, speaker_entries[i].freq, pos_samples_fixed, audio_freq);
-								pos_samples_fixed += 256;
-							}
-						} else {
-							for (j = audio_from; j < audio_to; j++) {
-								stream[j] = audio_generate_sample(audio_smp_min, audio_smp_max, freq_samples_fixed, speaker_entries[i].freq, pos_samples_fixed, audio_freq);
-								pos_samples_fixed += 256;
-							}
-						}
-					}
-					speaker_freq_ctr = (pos_samples_fixed >> 8);
+					freq_samples_fixed = (int) ((s->freq << 8) / (speaker_entries[i].freq * 2));
+					pos_samples_fixed = (s->speaker_freq_ctr << 8);
+					audio_stream_emit_note(s, stream, audio_from, audio_to, audio_smp_min, audio_smp_max, freq_samples_fixed, speaker_entries[i].freq, pos_samples_fixed);
+					pos_samples_fixed += (audio_to - audio_from) << 8;
+					s->speaker_freq_ctr = (pos_samples_fixed >> 8);
 				} else {
 					#ifdef AUDIO_STREAM_DEBUG
 					fprintf(stderr, "[callback] emitting off (%ld, %ld)\n", audio_from, audio_to);
 					#endif
-					speaker_freq_ctr = 0;
-					audio_stream_clear(stream, audio_smp_center, audio_from, audio_to);
+					s->speaker_freq_ctr = 0;
+					audio_stream_clear(s, stream, audio_smp_center, audio_from, audio_to);
 				}
 			}
 
@@ -261,119 +478,125 @@ void audio_stream_generate(long time, u8 *stream, int len) {
 		}
 
 		// Remove played notes.
-		if (speaker_entry_pos > 0) {
+		if (s->speaker_entry_pos > 0) {
 			k = note_played;
-			for (i = k; i < speaker_entry_pos; i++) {
+			for (i = k; i < s->speaker_entry_pos; i++) {
 				speaker_entries[i - k] = speaker_entries[i];
 			}
-			speaker_entry_pos -= k;
-			if (speaker_entry_pos <= 1) {
-				// If we only have one note, we can synchronize the
-				// internal timer with the external timer.
-				audio_curr_time = time;
-			}
-			if (speaker_entry_pos >= 1) {
+			s->speaker_entry_pos -= k;
+			if (s->speaker_entry_pos >= 1) {
 				speaker_entries[0].ms = audio_curr_time;
 			}
 		}
 
 		// Clear debug/error flags.
-		speaker_overrun_flagged = 0;
+		atomic_store(&s->speaker_overrun_flagged, false);
 	}
 
 #ifdef AUDIO_STREAM_DEBUG_BUFFERS
-	fprintf(stderr, "[callback] buffer state AFTER (%d)\n", speaker_entry_pos);
-	audio_stream_print_all_entries();
+	fprintf(stderr, "[callback] buffer state AFTER (%d)\n", s->speaker_entry_pos);
+	audio_stream_print_all_entries(s);
 #endif
 
-	audio_prev_time = audio_curr_time;
+	s->prev_time = audio_curr_time;
 }
 
-static void audio_stream_adjust_entry_timing(long time, int cycles) {
-	if (speaker_entry_pos > 0) {
-		double last_ms = speaker_entries[speaker_entry_pos - 1].ms + audio_local_delay_time(speaker_entries[speaker_entry_pos - 1].cycles, cycles, audio_freq);
-		if (audio_should_insert_pause(speaker_entries, speaker_entry_pos) && last_ms >= time) {
-			speaker_entries[speaker_entry_pos].ms = last_ms;
-		}
-	}
+void audio_stream_state_generate(audio_stream_state *s, long time, u8 *stream, int len) {
+	u64 start_us = audio_stream_time_us();
+	audio_stream_generate_inner(s, time, stream, len);
+	u64 duration_us = audio_stream_time_us() - start_us;
+
+	audio_stream_stat_add(&s->stat_callbacks, 1);
+	audio_stream_stat_add(&s->stat_callback_us_total, duration_us);
+	audio_stream_stat_max(&s->stat_callback_us_max, duration_us);
 }
 
-#ifndef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
-static bool audio_stream_ensure_size(int len) {
-	int old_speaker_len = speaker_entry_len;
-	speaker_entry *old_speaker_entries = speaker_entries;
-
-	if (speaker_entry_len == 0) {
-		speaker_entry_len = DEFAULT_SPEAKER_ENTRY_LEN;
-		speaker_entries = malloc(sizeof(speaker_entry) * speaker_entry_len);
-	} else if (len > speaker_entry_len) {
-		while (len > speaker_entry_len) {
-			speaker_entry_len *= 2;
-		}
-		fprintf(stderr, "speaker buffer overrun! scaling (%d -> %d)\n", old_speaker_len, speaker_entry_len);
-		speaker_entries = realloc(speaker_entries, sizeof(speaker_entry) * speaker_entry_len);
-		if (speaker_entries == NULL) {
-			speaker_entry_len = old_speaker_len;
-			speaker_entries = old_speaker_entries;
-			return false;
+void audio_stream_generate(long time, u8 *stream, int len) {
+	audio_stream_state_generate(&default_stream, time, stream, len);
+}
+
+int audio_stream_state_get_buffer_target(audio_stream_state *s, int min_len) {
+	int sample_size = s->a16bit ? 2 : 1;
+	int samples = (int) (s->jitter_avg * AUDIO_STREAM_JITTER_MARGIN * s->freq / 1000.0);
+	int len;
+
+	// round up to 256 samples
+	samples = (samples + 255) & ~255;
+	len = samples * sample_size;
+	if (len > min_len * AUDIO_STREAM_TARGET_MAX_BUFFERS) len = min_len * AUDIO_STREAM_TARGET_MAX_BUFFERS;
+	return len > min_len ? len : min_len;
+}
+
+int audio_stream_get_buffer_target(int min_len) {
+	return audio_stream_state_get_buffer_target(&default_stream, min_len);
+}
+
+static void audio_stream_adjust_entry_timing(audio_stream_state *s, speaker_entry *e) {
+	speaker_entry *history = s->speaker_history;
+
+	if (s->speaker_history_len > 0) {
+		speaker_entry *prev = &history[s->speaker_history_len - 1];
+		double last_ms = prev->ms + audio_local_delay_time(prev->cycles, e->cycles, s->freq);
+		history[s->speaker_history_len] = *e;
+		if (audio_should_insert_pause(history, s->speaker_history_len) && last_ms >= e->ms) {
+			e->ms = last_ms;
 		}
 	}
 
-	return true;
+	// keep the last two events
+	if (s->speaker_history_len == 2) {
+		history[0] = history[1];
+		s->speaker_history_len = 1;
+	}
+	history[s->speaker_history_len++] = *e;
 }
-#endif
 
-void audio_stream_append_on(long time, int cycles, double freq) {
-	// we want to reserve one extra speaker entry for an "off" command
-	// otherwise, large on-off-on-off-on... cycles could end on an "on"
-	// causing a permanent speaker noise
-#ifdef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
-	if (speaker_entry_pos >= (SPEAKER_ENTRY_LEN - 1)) {
-		audio_stream_flag_speaker_overrun();
-		return;
-	}
-#else
-	if (!audio_stream_ensure_size(speaker_entry_pos + 2)) {
-		audio_stream_flag_speaker_overrun();
+// Producer: queue an event, provided at least [reserve] slots are free.
+static void audio_stream_send(audio_stream_state *s, speaker_entry *e, unsigned int reserve) {
+	unsigned int head = atomic_load_explicit(&s->speaker_ring_head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&s->speaker_ring_tail, memory_order_acquire);
+
+	if ((SPEAKER_RING_LEN - (head - tail)) < reserve) {
+		audio_stream_flag_speaker_overrun(s);
 		return;
 	}
-#endif
 
-	speaker_entries[speaker_entry_pos].ms = time;
-	speaker_entries[speaker_entry_pos].cycles = cycles;
-	speaker_entries[speaker_entry_pos].freq = freq;
-	speaker_entries[speaker_entry_pos].enabled = 1;
-	audio_stream_adjust_entry_timing(time, cycles);
+	audio_stream_adjust_entry_timing(s, e);
+	s->speaker_ring[head & (SPEAKER_RING_LEN - 1)] = *e;
+	atomic_store_explicit(&s->speaker_ring_head, head + 1, memory_order_release);
 
 #ifdef AUDIO_STREAM_DEBUG
-	audio_stream_print(speaker_entry_pos);
+	audio_stream_print(e);
 #endif
-	speaker_entry_pos++;
 }
 
-void audio_stream_append_off(long time, int cycles) {
-#ifdef AUDIO_STREAM_SPEAKER_ENTRIES_STATIC
-	if (speaker_entry_pos >= SPEAKER_ENTRY_LEN) {
-		audio_stream_flag_speaker_overrun();
-		return;
-	}
-#else
-	if (!audio_stream_ensure_size(speaker_entry_pos + 1)) {
-		audio_stream_flag_speaker_overrun();
-		return;
-	}
-#endif
+void audio_stream_state_append_on(audio_stream_state *s, long time, int cycles, double freq) {
+	speaker_entry e;
+	e.ms = time;
+	e.cycles = cycles;
+	e.freq = freq;
+	e.enabled = 1;
 
-	if (time < audio_prev_time)
-		time = audio_prev_time;
+	// we want to reserve one extra speaker entry for an "off" command
+	// otherwise, large on-off-on-off-on... cycles could end on an "on"
+	// causing a permanent speaker noise
+	audio_stream_send(s, &e, 2);
+}
 
-	speaker_entries[speaker_entry_pos].ms = time;
-	speaker_entries[speaker_entry_pos].cycles = cycles;
-	speaker_entries[speaker_entry_pos].enabled = 0;
-	audio_stream_adjust_entry_timing(time, cycles);
+void audio_stream_state_append_off(audio_stream_state *s, long time, int cycles) {
+	speaker_entry e;
+	e.ms = time;
+	e.cycles = cycles;
+	e.freq = 0;
+	e.enabled = 0;
 
-#ifdef AUDIO_STREAM_DEBUG
-	audio_stream_print(speaker_entry_pos);
-#endif
-	speaker_entry_pos++;
+	audio_stream_send(s, &e, 1);
+}
+
+void audio_stream_append_on(long time, int cycles, double freq) {
+	audio_stream_state_append_on(&default_stream, time, cycles, freq);
+}
+
+void audio_stream_append_off(long time, int cycles) {
+	audio_stream_state_append_off(&default_stream, time, cycles);
 }
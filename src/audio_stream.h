@@ -25,6 +25,45 @@
 
 #include "types.h"
 
+typedef struct s_audio_stream_state audio_stream_state;
+
+typedef struct {
+	u64 callbacks;
+	u64 callback_us_total; // time spent generating audio
+	u64 callback_us_max;
+	u64 entries; // speaker entries pending, summed over all callbacks
+	u64 entries_max;
+	u64 overruns; // times the event ring filled up
+	u64 entries_dropped; // events lost to a full ring
+	s64 drift_us; // incoming time minus expected stream time, last callback
+	u64 drift_us_max; // largest absolute drift
+	u64 jitter_us; // smoothed deviation of the drift from its average
+	s64 ratio_ppm; // current timeline rate correction
+	u64 resyncs; // times the drift was too large to correct smoothly
+} audio_stream_stats;
+
+// Each audio_stream_state is an independent speaker event stream, fed by
+// one producer (the emulator thread) and drained by one consumer (the audio
+// thread). The plain audio_stream_* functions operate on a built-in
+// instance.
+
+#ifndef AVOID_MALLOC
+audio_stream_state *audio_stream_create(int freq, bool asigned, bool a16bit);
+void audio_stream_free(audio_stream_state *s);
+#endif
+u8 audio_stream_state_get_volume(audio_stream_state *s);
+void audio_stream_state_set_volume(audio_stream_state *s, u8 volume);
+void audio_stream_state_generate(audio_stream_state *s, long time, u8 *stream, int len);
+void audio_stream_state_append_on(audio_stream_state *s, long time, int cycles, double freq);
+void audio_stream_state_append_off(audio_stream_state *s, long time, int cycles);
+void audio_stream_state_get_stats(audio_stream_state *s, audio_stream_stats *stats);
+void audio_stream_get_stats(audio_stream_stats *stats);
+// Bytes of audio worth keeping queued, given the measured callback jitter;
+// between [min_len] (the device's request) and a few times that. Call from
+// the audio thread.
+int audio_stream_state_get_buffer_target(audio_stream_state *s, int min_len);
+int audio_stream_get_buffer_target(int min_len);
+
 USER_FUNCTION
 void audio_stream_init(long time, int freq, bool asigned, bool a16bit);
 USER_FUNCTION
@@ -30,7 +30,8 @@
 
 #define AUDIO_MIN_SAMPLE (25 << 8)
 #define AUDIO_MAX_SAMPLE (231 << 8)
-#define AUDIO_WRITER_MIN_ENTRIES_SIZE 4096
+#define AUDIO_WRITER_ENTRIES_SIZE 4096
+#define AUDIO_WRITER_CHUNK_LEN 4096
 
 typedef struct s_audio_writer_state {
 	FILE *file;
@@ -43,13 +44,14 @@ typedef struct s_audio_writer_state {
 	speaker_entry *entries;
 	u32 entries_count;
 	u32 entries_size;
+	u32 entries_written;
 	int note_counter;
 	u8 note_enabled; // last
 	int note_cycles; // last
 	double note_freq; // last
 } audio_writer_state;
 
-audio_writer_state *audio_writer_start(const char *filename, long time, int freq) {
+audio_writer_state *audio_writer_start(const char *filename, double time, int freq) {
 	FILE *file = fopen(filename, "wb");
 	if (file == NULL) return NULL;
 
@@ -83,12 +85,12 @@ audio_writer_state *audio_writer_start(const char *filename, long time, int freq
 	return s;
 }
 
-static void audio_writer_advance(audio_writer_state *s, int pos, long time, int cycles, u8 enabled, double freq) {
+static void audio_writer_advance(audio_writer_state *s, int pos, double time, int cycles, u8 enabled, double freq) {
 	long i, samples;
 	int freq_samples_fixed, pos_samples_fixed;
 
 	if (audio_should_insert_pause(s->entries, pos)) {
-		long shortest_time = s->time_offset + audio_local_delay_time(s->note_cycles, cycles, s->freq);
+		double shortest_time = s->time_offset + audio_local_delay_time(s->note_cycles, cycles, s->freq);
 		if (time < shortest_time) {
 			time = shortest_time;
 		}
@@ -100,15 +102,19 @@ static void audio_writer_advance(audio_writer_state *s, int pos, long time, int
 		// see audio_stream.c
 		freq_samples_fixed = (int) ((s->freq << 8) / (s->note_freq * 2));
 		pos_samples_fixed = (s->note_counter << 8);
-		for (i = 0; i < samples; i++) {
-			u16 sample = audio_generate_sample(AUDIO_MIN_SAMPLE, AUDIO_MAX_SAMPLE, freq_samples_fixed, s->note_freq, pos_samples_fixed, s->freq);
-			sample >>= (16 - s->bits_per_sample);
-			if (s->bits_per_sample == 16) {
-				fput16le(s->file, sample ^ 0x8000);
-			} else {
-				fputc(sample, s->file);
+		for (i = 0; i < samples; i += AUDIO_WRITER_CHUNK_LEN) {
+			u16 chunk[AUDIO_WRITER_CHUNK_LEN];
+			int len = (samples - i) < AUDIO_WRITER_CHUNK_LEN ? (samples - i) : AUDIO_WRITER_CHUNK_LEN;
+			audio_generate_samples(chunk, len, AUDIO_MIN_SAMPLE, AUDIO_MAX_SAMPLE, freq_samples_fixed, s->note_freq, pos_samples_fixed, s->freq);
+			for (int j = 0; j < len; j++) {
+				u16 sample = chunk[j] >> (16 - s->bits_per_sample);
+				if (s->bits_per_sample == 16) {
+					fput16le(s->file, sample ^ 0x8000);
+				} else {
+					fputc(sample, s->file);
+				}
 			}
-			pos_samples_fixed += (1 << 8);
+			pos_samples_fixed += len << 8;
 		}
 	} else {
 		// write silence
@@ -130,14 +136,24 @@ static void audio_writer_advance(audio_writer_state *s, int pos, long time, int
 	else s->note_counter += samples;
 }
 
-void audio_writer_stop(audio_writer_state *s, long time, int cycles) {
-	speaker_entry *e;
-	audio_writer_speaker_off(s, time, cycles);
-	// write... uhh... all data
-	e = s->entries;
-	for (int i = 0; i < s->entries_count; i++, e++) {
+// Renders all pending entries. Rendering an entry only looks back at the
+// two before it, so only those are kept, bounding memory use.
+static void audio_writer_flush(audio_writer_state *s) {
+	speaker_entry *e = s->entries + s->entries_written;
+	for (u32 i = s->entries_written; i < s->entries_count; i++, e++) {
 		audio_writer_advance(s, i, e->ms, e->cycles, e->enabled, e->freq);
 	}
+
+	if (s->entries_count > 2) {
+		memmove(s->entries, s->entries + s->entries_count - 2, sizeof(speaker_entry) * 2);
+		s->entries_count = 2;
+	}
+	s->entries_written = s->entries_count;
+}
+
+void audio_writer_stop(audio_writer_state *s, double time, int cycles) {
+	audio_writer_speaker_off(s, time, cycles);
+	audio_writer_flush(s);
 	// get filesize
 	fseek(s->file, 0, SEEK_END);
 	int filesize = (int) ftell(s->file);
@@ -151,22 +167,22 @@ void audio_writer_stop(audio_writer_state *s, long time, int cycles) {
 	free(s->vbuf);
 	free(s->entries);
 	free(s);
+	audio_wavetable_free_thread();
 }
 
 static speaker_entry* audio_writer_allocate_entry(audio_writer_state *s) {
 	if (s->entries_count >= s->entries_size) {
 		if (s->entries_size == 0) {
-			s->entries_size = AUDIO_WRITER_MIN_ENTRIES_SIZE;
+			s->entries_size = AUDIO_WRITER_ENTRIES_SIZE;
 			s->entries = malloc(sizeof(speaker_entry) * s->entries_size);
 		} else {
-			s->entries_size *= 2;
-			s->entries = realloc(s->entries, sizeof(speaker_entry) * s->entries_size);
+			audio_writer_flush(s);
 		}
 	}
 	return &(s->entries[s->entries_count++]);
 }
 
-void audio_writer_speaker_on(audio_writer_state *s, long time, int cycles, double freq) {
+void audio_writer_speaker_on(audio_writer_state *s, double time, int cycles, double freq) {
 	speaker_entry *e = audio_writer_allocate_entry(s);
 	e->enabled = 1;
 	e->freq = freq;
@@ -174,7 +190,7 @@ void audio_writer_speaker_on(audio_writer_state *s, long time, int cycles, doubl
 	e->cycles = cycles;
 }
 
-void audio_writer_speaker_off(audio_writer_state *s, long time, int cycles) {
+void audio_writer_speaker_off(audio_writer_state *s, double time, int cycles) {
 	speaker_entry *e = audio_writer_allocate_entry(s);
 	e->enabled = 0;
 	e->ms = time;
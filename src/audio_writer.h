@@ -28,9 +28,9 @@
 
 typedef struct s_audio_writer_state audio_writer_state;
 
-audio_writer_state *audio_writer_start(const char *filename, long time, int freq);
-void audio_writer_stop(audio_writer_state *s, long time, int cycles);
-void audio_writer_speaker_on(audio_writer_state *s, long time, int cycles, double freq);
-void audio_writer_speaker_off(audio_writer_state *s, long time, int cycles);
+audio_writer_state *audio_writer_start(const char *filename, double time, int freq);
+void audio_writer_stop(audio_writer_state *s, double time, int cycles);
+void audio_writer_speaker_on(audio_writer_state *s, double time, int cycles, double freq);
+void audio_writer_speaker_off(audio_writer_state *s, double time, int cycles);
 
 #endif
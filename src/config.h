@@ -27,6 +27,7 @@
 
 #define ENABLE_AUDIO_WRITER
 #define ENABLE_GIF_WRITER
+#define ENABLE_TRACE_WRITER
 #define ENABLE_SCREENSHOTS
 #define USE_GETOPT
 #define POSIX_VFS_SORTED_DIRS
@@ -66,13 +66,24 @@ static s16 ram_s16(cpu_state* cpu, u32 addr) {
 #endif
 } */
 
+static inline void ram_mark_vram(cpu_state* cpu, u32 addr) {
+	u32 cell = (addr - VRAM_DIRTY_BASE) >> 1;
+	if (cell < VRAM_DIRTY_CELLS) {
+		cpu->vram_dirty[cell >> 3] |= 1 << (cell & 7);
+		cpu->vram_dirty_any = true;
+	}
+}
+
 static void ram_w8(cpu_state* cpu, u32 addr, u8 v) {
 	*((u8*) (cpu->ram + addr)) = v;
+	ram_mark_vram(cpu, addr);
 }
 
 static void ram_w16(cpu_state* cpu, u32 addr, u16 v) {
 #if defined(UNALIGNED_OK) && !defined(ZETA_BIG_ENDIAN)
 	*((u16*) (cpu->ram + addr)) = v;
+	ram_mark_vram(cpu, addr);
+	ram_mark_vram(cpu, addr + 1);
 #else
 	ram_w8(cpu, addr, (u8) v);
 	ram_w8(cpu, addr + 1, (u8) (v >> 8));
@@ -200,6 +211,25 @@ void cpu_set_ip(cpu_state* cpu, u16 cs, u16 ip) {
 	cpu->ip = ip;
 }
 
+void cpu_mark_vram_dirty(cpu_state* cpu, u32 addr, u32 len) {
+	u32 cell, cell_end;
+
+	if (len == 0 || addr + len <= VRAM_DIRTY_BASE || addr >= VRAM_DIRTY_BASE + VRAM_DIRTY_CELLS * 2)
+		return;
+	cell = addr < VRAM_DIRTY_BASE ? 0 : ((addr - VRAM_DIRTY_BASE) >> 1);
+	cell_end = (addr + len - VRAM_DIRTY_BASE + 1) >> 1;
+	if (cell_end > VRAM_DIRTY_CELLS)
+		cell_end = VRAM_DIRTY_CELLS;
+
+	for (; cell < cell_end && (cell & 7); cell++)
+		cpu->vram_dirty[cell >> 3] |= 1 << (cell & 7);
+	for (; cell + 8 <= cell_end; cell += 8)
+		cpu->vram_dirty[cell >> 3] = 0xFF;
+	for (; cell < cell_end; cell++)
+		cpu->vram_dirty[cell >> 3] |= 1 << (cell & 7);
+	cpu->vram_dirty_any = true;
+}
+
 void cpu_init_globals(void) {
 	generate_mrm_table();
 	generate_parity_table();
@@ -1671,6 +1701,7 @@ void cpu_init(cpu_state* cpu) {
 #else
 	memset(cpu->ram + 1024, 0, 1048576 - 1024);
 #endif
+	cpu_mark_vram_dirty(cpu, VRAM_DIRTY_BASE, VRAM_DIRTY_CELLS * 2);
 
 	// ivt
 	for (i = 0; i < 256; i++) {
@@ -42,8 +42,14 @@
 #define SEG_SS 2
 #define SEG_DS 3
 
+// text-mode VRAM write tracking, one bit per 2-byte cell
+#define VRAM_DIRTY_BASE 0xB8000
+#define VRAM_DIRTY_CELLS (80*50)
+
 struct s_cpu_state {
 	u8 ram[1048576];
+	u8 vram_dirty[VRAM_DIRTY_CELLS >> 3];
+	bool vram_dirty_any;
 
 	struct {
 		union {
@@ -126,6 +132,7 @@ u16 cpu_pop16(cpu_state* cpu);
 
 void cpu_emit_interrupt(cpu_state* cpu, u8 intr);
 u32 cpu_get_ip(cpu_state *cpu);
+void cpu_mark_vram_dirty(cpu_state* cpu, u32 addr, u32 len);
 void cpu_set_ip(cpu_state* cpu, u16 cs, u16 ip);
 
 // external
@@ -0,0 +1,663 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "zzt.h"
+#include "posix_vfs.h"
+
+long zeta_time_ms(void) {
+	struct timespec spec;
+
+	clock_gettime(CLOCK_REALTIME, &spec);
+	return ((long) spec.tv_sec * 1000) + (long) (spec.tv_nsec / 1000000);
+}
+
+void cpu_ext_log(const char* s) {
+//	fprintf(stderr, "%s\n", s);
+}
+
+void speaker_on(int cycles, double freq) {}
+void speaker_off(int cycles) {}
+
+#include "frontend_curses_tables.c"
+
+int zeta_has_feature(int feature) {
+	return 1;
+}
+
+static u32 *palette_data = NULL;
+static bool palette_changed = false;
+static int blink_duration_ms = 0;
+
+void zeta_update_charset(int width, int height, u8* data) {
+}
+
+void zeta_update_palette(u32* data) {
+	palette_data = data;
+	palette_changed = true;
+}
+
+void zeta_update_blink(int blink) {
+	if ((blink < 0) != (blink_duration_ms < 0)) {
+		palette_changed = true;
+	}
+	blink_duration_ms = blink;
+}
+
+void zeta_show_developer_warning(const char *format, ...) {
+
+}
+
+#define ANSI_MAX_CLIENTS 64
+#define ANSI_FRAME_MS 20
+#define ANSI_KEYFRAME_MS 10000
+// Up to this many unchanged cells are re-sent instead of moving the cursor over them.
+#define ANSI_MAX_GAP_FILL 4
+
+static const char *ansi_socket_path = NULL;
+static long ansi_keyframe_ms = ANSI_KEYFRAME_MS;
+static bool ansi_truecolor = false;
+
+static void posix_zzt_extra_help(void) {
+	fprintf(stderr, "  -C     emit 24-bit palette colors instead of the 16 ANSI colors\n");
+	fprintf(stderr, "  -k []  full screen refresh interval, in seconds (default: 10)\n");
+	fprintf(stderr, "  -o []  serve the stream on a Unix socket at the given path\n");
+}
+
+static int posix_zzt_extra_option(int c, char *arg) {
+	switch (c) {
+		case 'C':
+			ansi_truecolor = true;
+			return 0;
+		case 'k':
+			ansi_keyframe_ms = (long) (atof(arg) * 1000);
+			if (ansi_keyframe_ms <= 0) {
+				fprintf(stderr, "Invalid refresh interval specified!\n");
+				return -1;
+			}
+			return 0;
+		case 'o':
+			ansi_socket_path = arg;
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+#include "asset_loader.h"
+
+#define FRONTEND_POSIX_NO_AUDIO
+#define FRONTEND_POSIX_EXTRA_OPTIONS "Ck:o:"
+#include "frontend_posix.c"
+
+typedef struct {
+	char *data;
+	size_t len, size;
+} ansi_buffer;
+
+// what the viewer's terminal currently has selected; -1 if unknown
+typedef struct {
+	int x, y;
+	int fg, bg, blink;
+} ansi_term_state;
+
+// Client sockets are non-blocking. Whatever a write cannot take right away
+// is kept in the client's buffer; a client which still has data pending
+// when the next frame arrives skips it and is resynchronized with a
+// keyframe once it catches up, so its buffer never holds more than one
+// frame's worth of data.
+typedef struct {
+	int fd;
+	bool synced;
+	ansi_buffer out;
+	size_t out_pos;
+} ansi_client;
+
+static const int ansi_color_map[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+static ansi_buffer frame_buf, keyframe_buf;
+static ansi_term_state term_state;
+static u8 shadow_vram[80 * 50 * 2];
+static int shadow_width, shadow_height;
+static zzt_vram_dirty ansi_vram_dirty;
+static long last_keyframe_ms;
+
+static int listen_fd = -1;
+static ansi_client clients[ANSI_MAX_CLIENTS];
+static int client_count;
+
+static struct termios orig_termios;
+static bool termios_changed = false;
+
+static void ansi_buf_append(ansi_buffer *b, const char *s, size_t len) {
+	if (b->len + len > b->size) {
+		size_t new_size = b->size > 0 ? b->size : 4096;
+		while (b->len + len > new_size) {
+			new_size *= 2;
+		}
+		char *new_data = realloc(b->data, new_size);
+		if (new_data == NULL) {
+			return;
+		}
+		b->data = new_data;
+		b->size = new_size;
+	}
+	memcpy(b->data + b->len, s, len);
+	b->len += len;
+}
+
+static void ansi_buf_puts(ansi_buffer *b, const char *s) {
+	ansi_buf_append(b, s, strlen(s));
+}
+
+static void ansi_term_reset(ansi_term_state *t) {
+	t->x = -1;
+	t->y = -1;
+	t->fg = -1;
+	t->bg = -1;
+	t->blink = -1;
+}
+
+static void ansi_col_split(u8 col, int *fg, int *bg, int *blink) {
+	*fg = col & 0x0F;
+	if (blink_duration_ms < 0) {
+		*bg = col >> 4;
+		*blink = 0;
+	} else {
+		*bg = (col >> 4) & 0x07;
+		*blink = col >> 7;
+	}
+}
+
+static int ansi_color_param(char *out, int color, bool background) {
+	if (ansi_truecolor && palette_data != NULL) {
+		u32 rgb = palette_data[color];
+		return sprintf(out, "%d;2;%d;%d;%d", background ? 48 : 38,
+			(int) ((rgb >> 16) & 0xFF), (int) ((rgb >> 8) & 0xFF), (int) (rgb & 0xFF));
+	} else {
+		int base = (color & 8) ? (background ? 100 : 90) : (background ? 40 : 30);
+		return sprintf(out, "%d", base + ansi_color_map[color & 7]);
+	}
+}
+
+// Emits only the SGR parameters which differ from the terminal's current state.
+static void ansi_emit_sgr(ansi_buffer *b, ansi_term_state *t, int fg, int bg, int blink) {
+	char out[64];
+	int len = 2;
+
+	out[0] = '\x1b';
+	out[1] = '[';
+	if (blink >= 0 && blink != t->blink) {
+		len += sprintf(out + len, "%s;", blink ? "5" : "25");
+		t->blink = blink;
+	}
+	if (fg >= 0 && fg != t->fg) {
+		len += ansi_color_param(out + len, fg, false);
+		out[len++] = ';';
+		t->fg = fg;
+	}
+	if (bg >= 0 && bg != t->bg) {
+		len += ansi_color_param(out + len, bg, true);
+		out[len++] = ';';
+		t->bg = bg;
+	}
+
+	if (len > 2) {
+		out[len - 1] = 'm';
+		ansi_buf_append(b, out, len);
+	}
+}
+
+// Prefers the shorter relative or column-only moves when staying on the same row.
+static void ansi_emit_move(ansi_buffer *b, ansi_term_state *t, int x, int y) {
+	char out[32];
+	int len;
+
+	if (t->x == x && t->y == y) {
+		return;
+	}
+
+	if (t->y == y && t->x >= 0) {
+		int dist = x - t->x;
+		if (dist == 1) {
+			len = sprintf(out, "\x1b[C");
+		} else if (dist > 0) {
+			len = sprintf(out, "\x1b[%dC", dist);
+		} else if (x == 0) {
+			len = sprintf(out, "\r");
+		} else {
+			len = sprintf(out, "\x1b[%dG", x + 1);
+		}
+	} else if (x == 0) {
+		len = sprintf(out, "\x1b[%dH", y + 1);
+	} else {
+		len = sprintf(out, "\x1b[%d;%dH", y + 1, x + 1);
+	}
+
+	ansi_buf_append(b, out, len);
+	t->x = x;
+	t->y = y;
+}
+
+static void ansi_emit_cell(ansi_buffer *b, ansi_term_state *t, u8 *cell, int swidth) {
+	int fg, bg, blink;
+
+	ansi_col_split(cell[1], &fg, &bg, &blink);
+	ansi_emit_sgr(b, t, fg, bg, blink);
+	ansi_buf_puts(b, map_char_to_unicode[cell[0]]);
+
+	// the cursor position after writing to the last column is terminal-dependent
+	if (++t->x >= swidth) {
+		t->x = -1;
+	}
+}
+
+// Returns true if the cells from x1 to x2 can be re-sent without changing the attributes.
+static bool ansi_can_fill_gap(ansi_term_state *t, u8 *row, int x1, int x2) {
+	int fg, bg, blink;
+
+	if (x2 - x1 + 1 > ANSI_MAX_GAP_FILL) {
+		return false;
+	}
+
+	for (int x = x1; x <= x2; x++) {
+		ansi_col_split(row[x * 2 + 1], &fg, &bg, &blink);
+		if (fg != t->fg || bg != t->bg || blink != t->blink) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool ansi_row_dirty(u8 *dirty, int y, int swidth) {
+	// screen widths are multiples of 8, so each row starts on a bitmap byte
+	for (int i = (y * swidth) >> 3; i < ((y + 1) * swidth) >> 3; i++) {
+		if (dirty[i]) return true;
+	}
+	return false;
+}
+
+static void ansi_encode_delta(ansi_buffer *b, ansi_term_state *t, u8 *vram, u8 *dirty, int swidth, int sheight) {
+	for (int y = 0; y < sheight; y++) {
+		u8 *row = vram + (y * swidth * 2);
+		u8 *shadow_row = shadow_vram + (y * swidth * 2);
+
+		if (!ansi_row_dirty(dirty, y, swidth) || !memcmp(row, shadow_row, swidth * 2)) {
+			continue;
+		}
+
+		for (int x = 0; x < swidth; x++) {
+			int cell = y * swidth + x;
+			if (!(dirty[cell >> 3] & (1 << (cell & 7)))
+				|| (row[x * 2] == shadow_row[x * 2] && row[x * 2 + 1] == shadow_row[x * 2 + 1]))
+			{
+				continue;
+			}
+
+			if (t->y == y && t->x >= 0 && t->x < x && ansi_can_fill_gap(t, row, t->x, x - 1)) {
+				for (int gx = t->x; gx < x; gx++) {
+					ansi_emit_cell(b, t, row + (gx * 2), swidth);
+				}
+			} else {
+				ansi_emit_move(b, t, x, y);
+			}
+			ansi_emit_cell(b, t, row + (x * 2), swidth);
+		}
+
+		memcpy(shadow_row, row, swidth * 2);
+	}
+}
+
+// Redraws the whole screen from scratch. If sync is not NULL, the terminal is
+// left in the state described by it afterwards, so that a client joining
+// mid-stream can follow the deltas sent to everyone else.
+static void ansi_encode_keyframe(ansi_buffer *b, ansi_term_state *t, u8 *vram, int swidth, int sheight, ansi_term_state *sync) {
+	ansi_term_reset(t);
+	ansi_buf_puts(b, "\x1b[?25l\x1b[0m\x1b[2J");
+	t->blink = 0;
+
+	for (int y = 0; y < sheight; y++) {
+		ansi_emit_move(b, t, 0, y);
+		for (int x = 0; x < swidth; x++) {
+			ansi_emit_cell(b, t, vram + ((y * swidth + x) * 2), swidth);
+		}
+	}
+
+	if (sync != NULL) {
+		if (sync->x >= 0 && sync->y >= 0) {
+			ansi_emit_move(b, t, sync->x, sync->y);
+		}
+		ansi_emit_sgr(b, t, sync->fg, sync->bg, sync->blink);
+	}
+}
+
+static bool ansi_write(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+static void ansi_drop_client(int i) {
+	close(clients[i].fd);
+	free(clients[i].out.data);
+	clients[i] = clients[--client_count];
+}
+
+// Returns false if the client has gone away.
+static bool ansi_client_flush(ansi_client *c) {
+	while (c->out_pos < c->out.len) {
+		ssize_t written = write(c->fd, c->out.data + c->out_pos, c->out.len - c->out_pos);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return false;
+		}
+		c->out_pos += written;
+	}
+	if (c->out_pos >= c->out.len) {
+		c->out.len = 0;
+		c->out_pos = 0;
+	}
+	return true;
+}
+
+static bool ansi_client_send(ansi_client *c, const char *data, size_t len) {
+	if (!ansi_client_flush(c)) {
+		return false;
+	}
+	if (c->out.len > 0) {
+		// still busy with an earlier frame; skip this one
+		c->synced = false;
+		return true;
+	}
+	ansi_buf_append(&c->out, data, len);
+	if (c->out.len < len) {
+		return false;
+	}
+	return ansi_client_flush(c);
+}
+
+static void ansi_accept_clients(void) {
+	if (listen_fd < 0) {
+		return;
+	}
+
+	while (client_count < ANSI_MAX_CLIENTS) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			break;
+		}
+		// accepted sockets do not inherit O_NONBLOCK on every platform
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+			close(fd);
+			continue;
+		}
+		memset(&clients[client_count], 0, sizeof(ansi_client));
+		clients[client_count].fd = fd;
+		clients[client_count].synced = false;
+		client_count++;
+	}
+}
+
+static void ansi_send(const char *data, size_t len, bool synced_only) {
+	if (listen_fd < 0) {
+		ansi_write(STDOUT_FILENO, data, len);
+		return;
+	}
+
+	for (int i = client_count - 1; i >= 0; i--) {
+		if (synced_only && !clients[i].synced) continue;
+		if (!ansi_client_send(&clients[i], data, len)) {
+			ansi_drop_client(i);
+		}
+	}
+}
+
+static void ansi_update(long curr_ms) {
+	int swidth, sheight;
+	u8 *vram = zzt_get_ram() + 0xB8000;
+
+	zzt_get_screen_size(&swidth, &sheight);
+	zzt_update_vram_dirty();
+	ansi_accept_clients();
+
+	frame_buf.len = 0;
+	if (palette_changed || swidth != shadow_width || sheight != shadow_height
+		|| (curr_ms - last_keyframe_ms) >= ansi_keyframe_ms)
+	{
+		ansi_encode_keyframe(&frame_buf, &term_state, vram, swidth, sheight, NULL);
+		memcpy(shadow_vram, vram, swidth * sheight * 2);
+		shadow_width = swidth;
+		shadow_height = sheight;
+		palette_changed = false;
+		last_keyframe_ms = curr_ms;
+
+		for (int i = 0; i < client_count; i++) {
+			clients[i].synced = true;
+		}
+		zzt_clear_vram_dirty(&ansi_vram_dirty);
+		ansi_send(frame_buf.data, frame_buf.len, false);
+		return;
+	}
+
+	if (ansi_vram_dirty.any) {
+		ansi_encode_delta(&frame_buf, &term_state, vram, ansi_vram_dirty.cells, swidth, sheight);
+		zzt_clear_vram_dirty(&ansi_vram_dirty);
+		if (frame_buf.len > 0) {
+			ansi_send(frame_buf.data, frame_buf.len, true);
+		}
+	}
+
+	for (int i = client_count - 1; i >= 0; i--) {
+		if (!ansi_client_flush(&clients[i])) {
+			ansi_drop_client(i);
+		} else if (!clients[i].synced && clients[i].out.len == 0) {
+			ansi_term_state t;
+			keyframe_buf.len = 0;
+			ansi_encode_keyframe(&keyframe_buf, &t, shadow_vram, swidth, sheight, &term_state);
+			clients[i].synced = true;
+			if (!ansi_client_send(&clients[i], keyframe_buf.data, keyframe_buf.len)) {
+				ansi_drop_client(i);
+			}
+		}
+	}
+}
+
+static int ansi_listen(const char *path) {
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+static void ansi_restore_terminal(void) {
+	if (termios_changed) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+		termios_changed = false;
+	}
+	if (listen_fd < 0) {
+		const char *reset = "\x1b[0m\x1b[?25h\r\n";
+		ansi_write(STDOUT_FILENO, reset, strlen(reset));
+	}
+}
+
+static void ansi_init_keyboard(void) {
+	struct termios raw;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &orig_termios) < 0) {
+		return;
+	}
+
+	raw = orig_termios;
+	raw.c_iflag &= ~(ICRNL | IXON);
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+	// reads return immediately, without making the shared tty descriptor non-blocking
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0) {
+		termios_changed = true;
+	}
+}
+
+static void ansi_press_key(int c) {
+	if (c == 0 || map_char_to_key[c] != 0) {
+		int k = map_char_to_key[c];
+		zzt_key(c, k);
+		zzt_keyup(k);
+	}
+}
+
+static void platform_kbd_tick(void) {
+	u8 buf[64];
+
+	if (!termios_changed) {
+		return;
+	}
+
+	ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+	for (ssize_t i = 0; i < len; i++) {
+		int c = buf[i];
+		if (c == 27) {
+			if (i + 2 < len && buf[i + 1] == '[') {
+				switch (buf[i + 2]) {
+					case 'A': ansi_press_key(259); break;
+					case 'B': ansi_press_key(258); break;
+					case 'C': ansi_press_key(261); break;
+					case 'D': ansi_press_key(260); break;
+				}
+				i += 2;
+			} else {
+				zzt_key(27, 0x01);
+				zzt_keyup(0x01);
+			}
+			continue;
+		}
+		if (c == 127) c = 8;
+		if (c == '\n') c = 13;
+		ansi_press_key(c);
+	}
+}
+
+int main(int argc, char** argv) {
+	init_map_char_to_key();
+
+	if (posix_zzt_init(argc, argv) < 0) {
+		fprintf(stderr, "Could not load ZZT!\n");
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (ansi_socket_path != NULL) {
+		listen_fd = ansi_listen(ansi_socket_path);
+		if (listen_fd < 0) {
+			return 1;
+		}
+	}
+
+	ansi_init_keyboard();
+	atexit(ansi_restore_terminal);
+
+	ansi_term_reset(&term_state);
+	zzt_register_vram_dirty(&ansi_vram_dirty);
+	palette_changed = true;
+
+	long timer_ms = zeta_time_ms();
+	long render_ms = timer_ms;
+
+	int rcode = 0;
+
+	while ((rcode = zzt_execute(64000)) > 0) {
+		long curr_ms = zeta_time_ms();
+
+		if ((curr_ms - render_ms) >= ANSI_FRAME_MS) {
+			ansi_update(curr_ms);
+			render_ms = curr_ms;
+		}
+
+		zzt_mark_frame();
+
+		if (rcode == 3) {
+			long sleep_time = 55 - (curr_ms - timer_ms);
+			if (sleep_time > 1) {
+				usleep(sleep_time * 1000);
+			}
+		}
+
+		if ((curr_ms - timer_ms) >= 55) {
+			zzt_mark_timer();
+			timer_ms = curr_ms;
+		}
+
+		platform_kbd_tick();
+	}
+
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(ansi_socket_path);
+	}
+
+	return 0;
+}
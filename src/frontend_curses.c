@@ -60,10 +60,20 @@ int zeta_has_feature(int feature) {
 void zeta_update_charset(int width, int height, u8* data) {
 }
 
+static u32 *palette_data = NULL;
+static bool palette_changed = false;
+static int blink_duration_ms = 0;
+
 void zeta_update_palette(u32* data) {
+	palette_data = data;
+	palette_changed = true;
 }
 
 void zeta_update_blink(int blink) {
+	if ((blink < 0) != (blink_duration_ms < 0)) {
+		palette_changed = true;
+	}
+	blink_duration_ms = blink;
 }
 
 static void platform_kbd_tick(void) {
@@ -87,12 +97,192 @@ static int nc_color_map[] = {
 	COLOR_RED, COLOR_MAGENTA, COLOR_YELLOW, COLOR_WHITE
 };
 
+typedef enum {
+	NC_COLORS_BASIC,
+	NC_COLORS_256,
+	NC_COLORS_DIRECT
+} nc_color_mode_t;
+
+static nc_color_mode_t nc_color_mode;
+// terminal color for each ZZT palette entry
+static int nc_palette_colors[16];
+// color pair for each (fg | bg << 4) combination; 0 if not yet allocated
+static short nc_pair_cache[256];
+static short nc_pair_next;
+
 static void init_ncurses_colors(void) {
+#ifdef HAVE_INIT_EXTENDED_PAIR
+	if (COLORS >= 0x1000000 && COLOR_PAIRS > 256) {
+		nc_color_mode = NC_COLORS_DIRECT;
+		return;
+	}
+#endif
+	if (COLORS >= 256 && COLOR_PAIRS > 256) {
+		nc_color_mode = NC_COLORS_256;
+		return;
+	}
+
+	nc_color_mode = NC_COLORS_BASIC;
 	for (int i = 0; i < 64; i++) {
 		init_pair(i+1, nc_color_map[i&7], nc_color_map[i>>3]);
 	}
 }
 
+static int ncurses_cube_level(int v) {
+	return v < 48 ? 0 : (v < 115 ? 1 : (v - 35) / 40);
+}
+
+// Finds the closest color in the xterm 6x6x6 cube or grayscale ramp;
+// the first 16 colors are left alone, as they depend on the terminal's theme.
+static int ncurses_nearest_256(int r, int g, int b) {
+	static const int cube_values[6] = {0, 95, 135, 175, 215, 255};
+
+	int ri = ncurses_cube_level(r);
+	int gi = ncurses_cube_level(g);
+	int bi = ncurses_cube_level(b);
+	int cr = cube_values[ri] - r;
+	int cg = cube_values[gi] - g;
+	int cb = cube_values[bi] - b;
+	int cube_dist = cr*cr + cg*cg + cb*cb;
+
+	int gray_idx = ((r + g + b) / 3 - 3) / 10;
+	if (gray_idx < 0) gray_idx = 0;
+	else if (gray_idx > 23) gray_idx = 23;
+	int gray = 8 + gray_idx * 10;
+	int gray_dist = (gray-r)*(gray-r) + (gray-g)*(gray-g) + (gray-b)*(gray-b);
+
+	if (gray_dist < cube_dist) {
+		return 232 + gray_idx;
+	} else {
+		return 16 + ri * 36 + gi * 6 + bi;
+	}
+}
+
+static void ncurses_apply_palette(void) {
+	if (palette_data != NULL) {
+		for (int i = 0; i < 16; i++) {
+			int r = (palette_data[i] >> 16) & 0xFF;
+			int g = (palette_data[i] >> 8) & 0xFF;
+			int b = palette_data[i] & 0xFF;
+			if (nc_color_mode == NC_COLORS_DIRECT) {
+				nc_palette_colors[i] = (r << 16) | (g << 8) | b;
+			} else {
+				nc_palette_colors[i] = ncurses_nearest_256(r, g, b);
+			}
+		}
+	}
+
+	memset(nc_pair_cache, 0, sizeof(nc_pair_cache));
+	nc_pair_next = 1;
+}
+
+static short ncurses_get_pair(u8 col) {
+	int fg = col & 0x0F;
+	int bg = blink_duration_ms < 0 ? (col >> 4) : ((col >> 4) & 0x07);
+	int key = fg | (bg << 4);
+
+	if (nc_pair_cache[key] == 0) {
+#ifdef HAVE_INIT_EXTENDED_PAIR
+		init_extended_pair(nc_pair_next, nc_palette_colors[fg], nc_palette_colors[bg]);
+#else
+		init_pair(nc_pair_next, nc_palette_colors[fg], nc_palette_colors[bg]);
+#endif
+		nc_pair_cache[key] = nc_pair_next++;
+	}
+
+	return nc_pair_cache[key];
+}
+
+static void ncurses_set_attr(u8 col) {
+	attr_t attr = A_NORMAL;
+	short pair;
+
+	if (nc_color_mode == NC_COLORS_BASIC) {
+		pair = 1+((col & 7) | ((col & 0x70) >> 1) );
+		if ((col & 0x08) != 0) attr |= A_BOLD;
+	} else {
+		pair = ncurses_get_pair(col);
+	}
+
+	wattr_set(window, attr, pair, NULL);
+}
+
+// last VRAM contents handed to curses
+static u8 shadow_vram[80 * 25 * 2];
+static bool shadow_valid = false;
+static zzt_vram_dirty curses_vram_dirty;
+
+// Emits only the cells which differ from the shadow copy, batching runs of
+// adjacent changed cells sharing an attribute into a single addstr call.
+// Returns true if anything was emitted.
+static bool ncurses_update_screen(void) {
+	u8* ram = zzt_get_ram();
+	char run[80 * 4 + 1];
+	bool changed = false;
+
+	if (palette_changed) {
+		if (nc_color_mode != NC_COLORS_BASIC) {
+			ncurses_apply_palette();
+			shadow_valid = false;
+		}
+		palette_changed = false;
+	}
+
+	zzt_update_vram_dirty();
+	if (shadow_valid && !curses_vram_dirty.any) {
+		return false;
+	}
+
+	u8* dirty = curses_vram_dirty.cells;
+
+	for (int y = 0; y < 25; y++) {
+		u8 *row = ram + TEXT_ADDR(0,y);
+		u8 *shadow_row = shadow_vram + (y * 160);
+
+		if (shadow_valid) {
+			// 80 cells per row - 10 bitmap bytes
+			int i;
+			for (i = 0; i < 10; i++) {
+				if (dirty[y * 10 + i]) break;
+			}
+			if (i == 10 || !memcmp(row, shadow_row, 160)) {
+				continue;
+			}
+		}
+
+		int x = 0;
+		while (x < 80) {
+			if (shadow_valid && row[x*2] == shadow_row[x*2] && row[x*2+1] == shadow_row[x*2+1]) {
+				x++;
+				continue;
+			}
+
+			u8 col = row[x*2+1];
+			int run_x = x;
+			int run_len = 0;
+			while (x < 80 && row[x*2+1] == col
+				&& (!shadow_valid || row[x*2] != shadow_row[x*2] || col != shadow_row[x*2+1])) {
+				const char *chr = map_char_to_unicode[row[x*2]];
+				size_t chr_len = strlen(chr);
+				memcpy(run + run_len, chr, chr_len);
+				run_len += chr_len;
+				x++;
+			}
+			run[run_len] = 0;
+
+			ncurses_set_attr(col);
+			mvwaddstr(window, y, run_x, run);
+			changed = true;
+		}
+
+		memcpy(shadow_row, row, 160);
+	}
+
+	shadow_valid = true;
+	zzt_clear_vram_dirty(&curses_vram_dirty);
+	return changed;
+}
+
 void zeta_show_developer_warning(const char *format, ...) {
 	
 }
@@ -119,6 +309,8 @@ int main(int argc, char** argv) {
 
 	start_color();
 	init_ncurses_colors();
+	zzt_register_vram_dirty(&curses_vram_dirty);
+	palette_changed = true;
 /*	clock_t last = clock();
 	clock_t curr = last; */
 
@@ -132,22 +324,12 @@ int main(int argc, char** argv) {
 
 		if ((curr_ms - render_ms) >= 10) {
 			// refresh screen
-			u8* ram = zzt_get_ram();
-			for (int y = 0; y < 25; y++) {
-				for (int x = 0; x < 80; x++) {
-					u8 chr = ram[TEXT_ADDR(x,y)];
-					u8 col = ram[TEXT_ADDR(x,y)+1];
-
-					int attr = COLOR_PAIR(1+((col & 7) | ((col & 0x70) >> 1) ));
-					if ((col & 0x08) != 0) attr |= A_BOLD;
-					wattrset(window, attr);
-					mvwaddstr(window, y, x, map_char_to_unicode[chr]);
-				}
+			if (ncurses_update_screen()) {
+				wrefresh(window);
 			}
 			render_ms = curr_ms;
 		}
 
-		wrefresh(window);
 		zzt_mark_frame();
 
 /*		curr = clock();
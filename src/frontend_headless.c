@@ -24,6 +24,7 @@
 #define _POSIX_C_SOURCE 2
 #include <unistd.h>
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,7 +32,11 @@
 #include <locale.h>
 
 #include "zzt.h"
+#include "audio_shared.h"
+#include "audio_writer.h"
 #include "posix_vfs.h"
+#include "trace_writer.h"
+#include "video_writer.h"
 
 long zeta_time_ms(void) {
 	struct timespec spec;
@@ -44,17 +49,45 @@ void cpu_ext_log(const char* s) {
 //	fprintf(stderr, "%s\n", s);
 }
 
-void speaker_on(int cycles, double freq) {}
-void speaker_off(int cycles) {}
+static trace_writer_state *trace = NULL;
+static audio_writer_state *wav = NULL;
+static double time_ms = 0;
+static int speaker_cycles = 0;
+
+void speaker_on(int cycles, double freq) {
+	speaker_cycles = cycles;
+	if (wav != NULL) {
+		audio_writer_speaker_on(wav, time_ms, cycles, freq);
+	}
+	if (trace != NULL) {
+		trace_writer_speaker_on(trace, time_ms, cycles, freq);
+	}
+}
+
+void speaker_off(int cycles) {
+	speaker_cycles = cycles;
+	if (wav != NULL) {
+		audio_writer_speaker_off(wav, time_ms, cycles);
+	}
+	if (trace != NULL) {
+		trace_writer_speaker_off(trace, time_ms, cycles);
+	}
+}
 
 int zeta_has_feature(int feature) {
 	return 1;
 }
 
 void zeta_update_charset(int width, int height, u8* data) {
+	if (trace != NULL) {
+		trace_writer_on_charset_change(trace);
+	}
 }
 
 void zeta_update_palette(u32* data) {
+	if (trace != NULL) {
+		trace_writer_on_palette_change(trace);
+	}
 }
 
 void zeta_update_blink(int blink) {
@@ -69,7 +102,62 @@ void zeta_show_developer_warning(const char *format, ...) {
 	va_end(val);
 }
 
+static const char *trace_filename = NULL;
+static const char *video_filename = NULL;
+static const char *wav_filename = NULL;
+static int video_format = VIDEO_WRITER_FORMAT_Y4M;
+static int video_fps = 0;
+static double time_limit_ms = -1;
+
+static void posix_zzt_extra_help(void) {
+	fprintf(stderr, "  -f []  video output format: y4m (default) or rgb (raw RGB24)\n");
+	fprintf(stderr, "  -o []  write video to the given file; - for standard output\n");
+	fprintf(stderr, "  -r []  video frame rate (default: one frame per PIT tick)\n");
+	fprintf(stderr, "  -R []  record a session trace to the given file\n");
+	fprintf(stderr, "  -T []  stop after the given amount of emulated seconds\n");
+	fprintf(stderr, "  -w []  write the PC speaker output to a 48 kHz WAV file\n");
+}
+
+static int posix_zzt_extra_option(int c, char *arg) {
+	switch (c) {
+		case 'f':
+			if (!strcmp(arg, "y4m")) {
+				video_format = VIDEO_WRITER_FORMAT_Y4M;
+			} else if (!strcmp(arg, "rgb")) {
+				video_format = VIDEO_WRITER_FORMAT_RGB;
+			} else {
+				fprintf(stderr, "Invalid video format specified!\n");
+				return -1;
+			}
+			return 0;
+		case 'o':
+			video_filename = arg;
+			return 0;
+		case 'r':
+			video_fps = atoi(arg);
+			if (video_fps < 0) {
+				fprintf(stderr, "Invalid frame rate specified!\n");
+				return -1;
+			}
+			return 0;
+		case 'R':
+			trace_filename = arg;
+			return 0;
+		case 'T':
+			time_limit_ms = atof(arg) * 1000;
+			return 0;
+		case 'w':
+			wav_filename = arg;
+			return 0;
+		default:
+			return -1;
+	}
+}
+
 #include "asset_loader.h"
+
+#define FRONTEND_POSIX_NO_AUDIO
+#define FRONTEND_POSIX_EXTRA_OPTIONS "f:o:r:R:T:w:"
 #include "frontend_posix.c"
 
 int main(int argc, char** argv) {
@@ -79,6 +167,45 @@ int main(int argc, char** argv) {
 	}
 
 	int rcode = 0;
+	video_writer_state *video = NULL;
+
+	if (video_filename != NULL) {
+		video = video_writer_start(video_filename, video_format, video_fps);
+		if (video == NULL) {
+			fprintf(stderr, "Could not open video output %s!\n", video_filename);
+			return 1;
+		}
+	}
+
+	if (trace_filename != NULL) {
+		trace = trace_writer_start(trace_filename, 0);
+		if (trace == NULL) {
+			fprintf(stderr, "Could not open trace output %s!\n", trace_filename);
+			if (video != NULL) {
+				video_writer_stop(video);
+			}
+			return 1;
+		}
+	}
+
+	// rendered against emulated time, so it runs as fast as the emulator does
+	if (wav_filename != NULL) {
+		audio_generate_init();
+		if (posix_zzt_arg_note_delay >= 0.0) {
+			audio_set_note_delay(posix_zzt_arg_note_delay);
+		}
+		wav = audio_writer_start(wav_filename, 0, 48000);
+		if (wav == NULL) {
+			fprintf(stderr, "Could not open audio output %s!\n", wav_filename);
+			if (video != NULL) {
+				video_writer_stop(video);
+			}
+			if (trace != NULL) {
+				trace_writer_stop(trace);
+			}
+			return 1;
+		}
+	}
 
 	while ((rcode = zzt_execute(64000)) > 0) {
 		zzt_mark_frame();
@@ -88,6 +215,33 @@ int main(int argc, char** argv) {
 		fprintf(stderr, "%.2f opc/sec\n", 1600000.0f / secs);
 		last = curr; */
 
+		// each iteration counts as one PIT tick of emulated time
+		double tick_ms = zzt_get_pit_tick_ms();
 		zzt_mark_timer();
+
+		if (video != NULL && video_writer_frame(video, tick_ms) < 0) {
+			fprintf(stderr, "Could not write video frame!\n");
+			break;
+		}
+		if (trace != NULL && trace_writer_frame(trace, tick_ms) < 0) {
+			fprintf(stderr, "Could not write trace frame!\n");
+			break;
+		}
+
+		time_ms += tick_ms;
+		if (time_limit_ms >= 0 && time_ms >= time_limit_ms) {
+			break;
+		}
+	}
+
+	if (video != NULL) {
+		video_writer_stop(video);
+	}
+	if (trace != NULL) {
+		trace_writer_stop(trace);
+	}
+	if (wav != NULL) {
+		audio_writer_stop(wav, time_ms, speaker_cycles);
 	}
+	return 0;
 }
@@ -24,6 +24,15 @@
 
 double posix_zzt_arg_note_delay = -1.0;
 
+// Frontends can define FRONTEND_POSIX_EXTRA_OPTIONS as a getopt string of
+// their own options, and provide posix_zzt_extra_help() and
+// posix_zzt_extra_option(c, arg) (returning < 0 on error) to handle them.
+#ifdef FRONTEND_POSIX_EXTRA_OPTIONS
+#define POSIX_ZZT_OPTIONS "dD:be:hl:m:M:tV:" FRONTEND_POSIX_EXTRA_OPTIONS
+#else
+#define POSIX_ZZT_OPTIONS "dD:be:hl:m:M:tV:"
+#endif
+
 static void posix_vfs_chdir_arg0(char *argv0) {
 	if (argv0 == NULL || argv0[0] == 0) return;
 
@@ -49,7 +58,7 @@ static int posix_vfs_exists(const char *filename) {
 static void posix_zzt_help(int argc, char **argv) {
 	char *owner = (argc > 0 && argv[0] != NULL && strlen(argv[0]) > 0) ? argv[0] : "zeta";
 
-	fprintf(stderr, "Usage: %s [arguments] [world file]\n", owner);
+	fprintf(stderr, "Usage: %s [arguments] [world file or .zip archive]\n", owner);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Arguments ([] - parameter; * - may specify multiple times):\n");
 	fprintf(stderr, "  -b     disable blinking, enable bright backgrounds\n");
@@ -72,6 +81,9 @@ static void posix_zzt_help(int argc, char **argv) {
 	fprintf(stderr, "  -t     enable world testing mode (skip K, C, ENTER)\n");
 #ifndef FRONTEND_POSIX_NO_AUDIO
 	fprintf(stderr, "  -V []  set starting volume (0-100)\n");
+#endif
+#ifdef FRONTEND_POSIX_EXTRA_OPTIONS
+	posix_zzt_extra_help();
 #endif
 	fprintf(stderr, "\n");
 	fprintf(stderr, "See <https://zeta.asie.pl/> for more information.\n");
@@ -85,6 +97,29 @@ static void posix_zzt_help(int argc, char **argv) {
 
 #define MAX_BUFFER_SIZE 256
 
+// Picks the world to run from a mounted archive: its only .ZZT file (or,
+// failing that, its only .SZT file) in the root directory. Otherwise, the
+// choice is left to the engine.
+static void posix_zzt_find_zip_world(char *arg_name) {
+	char *specs[] = {"*.ZZT", "*.SZT"};
+	u8 dta[0x2C];
+
+	arg_name[0] = 0;
+	for (int i = 0; i < 2; i++) {
+		int count = 0;
+		if (vfs_findfirst(dta, 0, specs[i]) >= 0) {
+			do {
+				if (count++ == 0) {
+					strncpy(arg_name, (char*) (dta + 0x1E), MAX_BUFFER_SIZE);
+				}
+			} while (vfs_findnext(dta) >= 0);
+		}
+		if (count == 1) return;
+		arg_name[0] = 0;
+		if (count > 1) return;
+	}
+}
+
 static int posix_try_run_zzt(int exec_count, char **execs, const char *arg_name, bool is_final_attempt) {
 	char arg_buf[MAX_BUFFER_SIZE + 1];
 	arg_buf[0] = 0;
@@ -170,7 +205,7 @@ static int posix_zzt_init(int argc, char **argv) {
 	getcwd(cwd, PATH_MAX);
 
 #ifdef USE_GETOPT
-	while ((c = getopt(argc, argv, "dD:be:hl:m:M:tV:")) >= 0) {
+	while ((c = getopt(argc, argv, POSIX_ZZT_OPTIONS)) >= 0) {
 		switch(c) {
 			case 'd':
 				developer_mode = true;
@@ -222,6 +257,13 @@ static int posix_zzt_init(int argc, char **argv) {
 				fprintf(stderr, "Could not parse options! Try %s -h for help.\n", argc > 0 ? argv[0] : "running with");
 				exit(0);
 				return INIT_ERR_GENERIC;
+#ifdef FRONTEND_POSIX_EXTRA_OPTIONS
+			default:
+				if (posix_zzt_extra_option(c, optarg) < 0) {
+					return INIT_ERR_GENERIC;
+				}
+				break;
+#endif
 		}
 	}
 #endif
@@ -236,6 +278,15 @@ static int posix_zzt_init(int argc, char **argv) {
 	}
 #endif
 
+	const char *arg_world = NULL;
+#ifdef USE_GETOPT
+	if (argc > optind) arg_world = argv[optind];
+#else
+	if (argc > 1) arg_world = argv[1];
+#endif
+	if (arg_world != NULL && IS_EXTENSION(arg_world, ".zip") && posix_vfs_mount_zip(arg_world) >= 0) {
+		posix_zzt_find_zip_world(arg_name);
+	} else
 #ifdef USE_GETOPT
 	if (argc > optind && posix_vfs_exists(argv[optind])) {
 		strncpy(arg_name, argv[optind], MAX_BUFFER_SIZE);
@@ -23,6 +23,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "util.h"
 #include "zzt.h"
@@ -34,21 +38,64 @@
 #define GIF_MAX_BUFFER_POS 255
 #define LZW_CODE_UNDEFINED 0xFFFF
 
+// A frame's changes may be split into several image descriptors. All but the
+// last one are shown for GIF_SUBIMAGE_DELAY (browsers treat shorter delays
+// as 100ms), and that time is subtracted from the following frame delays.
+#define GIF_MAX_RECTS 4
+#define GIF_SUBIMAGE_DELAY 2
+// Estimated cost of an extra image descriptor, in pixels.
+#define GIF_RECT_OVERHEAD 1024
+// Transparent cells compress far better than drawn ones.
+#define GIF_TRANSPARENT_CELL_RATIO 8
+
+// Frames are snapshotted on the emulator thread and encoded on a background
+// thread; if the encoder falls behind, new frames are dropped (unless
+// GIF_WRITER_NO_DROP is set) and the previous one is shown for longer.
+#ifdef HAVE_PTHREAD
+#define GIF_QUEUE_SIZE 32
+#else
+#define GIF_QUEUE_SIZE 1
+#endif
+
+// Dictionary entries are stamped with the generation they were added in;
+// bumping the generation invalidates the whole table without clearing it.
+#define LZW_ENTRY(gen, code) (((u32) (gen) << 16) | (code))
+
 typedef struct {
-	u16 jumptable[(GIF_MAX_CODE_COUNT + 1) * GIF_MAX_COLOR_COUNT];
+	u32 jumptable[GIF_MAX_CODE_COUNT * GIF_MAX_COLOR_COUNT];
+	u16 generation;
 	u16 initial_max_code;
 	u16 current_max_code;
+	u16 next_width_code;
 	u16 current_code;
 	u16 buffer_pos;
-	u8 buffer[255];
+	u8 buffer[GIF_MAX_BUFFER_POS];
 	u8 bit_width;
-	u32 bitstream_partial;
+	u64 bitstream_partial;
 	u8 bitstream_offset;
 } lzw_encode_state;
 
+typedef struct {
+	u32 time; // in units of 10ms
+	int screen_width;
+	int screen_height;
+	int char_width;
+	int char_height;
+	bool blink;
+	bool blink_active;
+	bool charset_changed;
+	bool palette_changed;
+	u32 palette[16];
+	u8 video[80 * 50 * 2];
+	u8 charset[256 * 16];
+	bool video_dirty_any;
+	u8 video_dirty[VRAM_DIRTY_CELLS >> 3]; // cells written since the previous frame
+} gif_frame;
+
 typedef struct s_gif_writer_state {
 	FILE *file;
 	size_t file_delay_loc;
+	int flags;
 
 	char *vbuf;
 	bool optimize;
@@ -60,7 +107,10 @@ typedef struct s_gif_writer_state {
 	int char_width;
 	int char_height;
 
-	u8 prev_video[4000];
+	u8 prev_video[80 * 50 * 2];
+	bool prev_blink;
+	bool prev_blink_active;
+	u8 charset[256 * 16];
 	u32 global_palette[16];
 
 	size_t draw_buffer_size;
@@ -68,8 +118,29 @@ typedef struct s_gif_writer_state {
 	bool force_full_redraw;
 
 	lzw_encode_state lzw;
-
-	u32 accumulated_delay; // 16.16 fixed-point value, in units of 10ms
+	u8 vram_difference[4000 >> 3];
+
+	// Delays are derived from absolute time, so that rounding errors do not
+	// accumulate and separately encoded segments line up exactly.
+	u32 image_time; // start of the last written image, in units of 10ms
+	bool image_time_set;
+	int delay_debt; // in units of 10ms
+
+	// emulator thread side
+	double time_ms;
+	bool pending_charset_change;
+	bool pending_palette_change;
+	zzt_vram_dirty vram_dirty;
+
+	gif_frame *queue;
+	int queue_head;
+	int queue_count;
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_cond;
+	bool thread_quit;
+#endif
 } gif_writer_state;
 
 static void lzw_write_buffer(lzw_encode_state *lzw, FILE *file) {
@@ -91,20 +162,39 @@ static void lzw_clear_bitstream(lzw_encode_state *lzw, FILE *file, int limit) {
 	}
 }
 
-static void lzw_emit_code(lzw_encode_state *lzw, u16 code, FILE *file) {
-	lzw->bitstream_partial |= (code << lzw->bitstream_offset);
+static inline void lzw_emit_code(lzw_encode_state *lzw, u16 code, FILE *file) {
+	lzw->bitstream_partial |= ((u64) code << lzw->bitstream_offset);
 	lzw->bitstream_offset += lzw->bit_width;
-	lzw_clear_bitstream(lzw, file, 7);
+	// flush 32 bits at a time; at most 12 more can arrive before the next check
+	if (lzw->bitstream_offset >= 32) {
+		if (lzw->buffer_pos + 4 <= GIF_MAX_BUFFER_POS) {
+			u8 *buf = lzw->buffer + lzw->buffer_pos;
+			buf[0] = lzw->bitstream_partial;
+			buf[1] = lzw->bitstream_partial >> 8;
+			buf[2] = lzw->bitstream_partial >> 16;
+			buf[3] = lzw->bitstream_partial >> 24;
+			lzw->buffer_pos += 4;
+			lzw->bitstream_partial >>= 32;
+			lzw->bitstream_offset -= 32;
+		} else {
+			lzw_clear_bitstream(lzw, file, 7);
+		}
+	}
 }
 
 static void lzw_clear(lzw_encode_state *lzw, FILE *file, bool start) {
 	if (!start) {
 		lzw_emit_code(lzw, lzw->initial_max_code - 2, file); // clear code
 	}
-	memset(lzw->jumptable, 0xFF, sizeof(u16) * GIF_MAX_CODE_COUNT * GIF_MAX_COLOR_COUNT);
+	if (++lzw->generation == 0) {
+		// generation counter wrapped, stale stamps could match again
+		memset(lzw->jumptable, 0, sizeof(lzw->jumptable));
+		lzw->generation = 1;
+	}
 	lzw->current_max_code = lzw->initial_max_code;
 	lzw->current_code = LZW_CODE_UNDEFINED;
 	lzw->bit_width = highest_bit_index(lzw->current_max_code - 1) + 1;
+	lzw->next_width_code = (1 << lzw->bit_width) + 1;
 	if (start) {
 		u16 bpp = highest_bit_index(lzw->initial_max_code - 2);
 		fputc(bpp > 2 ? bpp : 2, file); // min code size
@@ -112,37 +202,39 @@ static void lzw_clear(lzw_encode_state *lzw, FILE *file, bool start) {
 	}
 }
 
-static void lzw_emit(lzw_encode_state *lzw, u8 color, FILE *file) {
+static inline void lzw_emit(lzw_encode_state *lzw, u8 color, FILE *file) {
 	if (lzw->current_code == LZW_CODE_UNDEFINED) {
-		lzw->current_code = GIF_MAX_CODE_COUNT;
+		lzw->current_code = color;
+		return;
 	}
-	int next_code_idx = lzw->current_code * GIF_MAX_COLOR_COUNT + color;
-	if (lzw->jumptable[next_code_idx] == LZW_CODE_UNDEFINED) {
+	u32 *entry = &lzw->jumptable[lzw->current_code * GIF_MAX_COLOR_COUNT + color];
+	if ((*entry >> 16) != lzw->generation) {
 		// emit
 		lzw_emit_code(lzw, lzw->current_code, file);
 		// add new code
 		if (lzw->current_max_code >= GIF_MAX_CODE_COUNT) {
 			lzw_clear(lzw, file, false);
 		} else {
-			lzw->jumptable[next_code_idx] = lzw->current_max_code++;
-			lzw->bit_width = highest_bit_index(lzw->current_max_code - 1) + 1;
+			*entry = LZW_ENTRY(lzw->generation, lzw->current_max_code++);
+			if (lzw->current_max_code == lzw->next_width_code) {
+				lzw->bit_width++;
+				lzw->next_width_code = (1 << lzw->bit_width) + 1;
+			}
 		}
 		// set to start
 		lzw->current_code = color;
 	} else {
 		// jump
-		lzw->current_code = lzw->jumptable[next_code_idx];
+		lzw->current_code = *entry & 0xFFFF;
 	}
 }
 
 static void lzw_init(lzw_encode_state *lzw, u16 colors, FILE *file) {
 	lzw->initial_max_code = colors + 2;
 	lzw->buffer_pos = 0;
+	lzw->bitstream_partial = 0;
+	lzw->bitstream_offset = 0;
 	lzw_clear(lzw, file, true);
-	// This area is never reset, so we set it here.
-	for (u16 i = 0; i < GIF_MAX_COLOR_COUNT; i++) {
-		lzw->jumptable[GIF_MAX_CODE_COUNT * GIF_MAX_COLOR_COUNT + i] = i;
-	}
 }
 
 static void lzw_finish(lzw_encode_state *lzw, FILE *file) {
@@ -178,26 +270,66 @@ static void gif_write_palette(gif_writer_state *s, u32 *palette, int colors) {
 	}
 }
 
-gif_writer_state *gif_writer_start(const char *filename, bool optimize, bool pad_palette) {
-	FILE *file = fopen(filename, "wb");
-	if (file == NULL) return NULL;
+static void gif_writer_encode_frame(gif_writer_state *s, gif_frame *f);
 
-	gif_writer_state *s = malloc(sizeof(gif_writer_state));
-	memset(s, 0, sizeof(gif_writer_state));
+#ifdef HAVE_PTHREAD
+static void *gif_writer_thread(void *arg) {
+	gif_writer_state *s = (gif_writer_state*) arg;
 
-	zzt_get_charset(&s->char_width, &s->char_height);
-	zzt_get_screen_size(&s->screen_width, &s->screen_height);
-	
-	s->file = file;
-	setvbuf(s->file, s->vbuf, _IOFBF, 65536);
+	pthread_mutex_lock(&s->queue_lock);
+	while (true) {
+		while (s->queue_count == 0 && !s->thread_quit) {
+			pthread_cond_wait(&s->queue_cond, &s->queue_lock);
+		}
+		if (s->queue_count == 0) break;
+		gif_frame *f = &s->queue[s->queue_head];
+		pthread_mutex_unlock(&s->queue_lock);
 
-	// prepare internal flags
-	s->force_full_redraw = true;
-	s->optimize = optimize;
-	s->pad_palette = pad_palette;
-	s->optimize_lcts = true;
-	
-	// write header
+		gif_writer_encode_frame(s, f);
+
+		pthread_mutex_lock(&s->queue_lock);
+		s->queue_head = (s->queue_head + 1) % GIF_QUEUE_SIZE;
+		s->queue_count--;
+		pthread_cond_signal(&s->queue_cond);
+	}
+	pthread_mutex_unlock(&s->queue_lock);
+
+	return NULL;
+}
+#endif
+
+static gif_frame *gif_queue_reserve(gif_writer_state *s) {
+	gif_frame *f = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&s->queue_lock);
+	if (s->flags & GIF_WRITER_NO_DROP) {
+		while (s->queue_count >= GIF_QUEUE_SIZE) {
+			pthread_cond_wait(&s->queue_cond, &s->queue_lock);
+		}
+	}
+	if (s->queue_count < GIF_QUEUE_SIZE) {
+		f = &s->queue[(s->queue_head + s->queue_count) % GIF_QUEUE_SIZE];
+	}
+	pthread_mutex_unlock(&s->queue_lock);
+#else
+	f = &s->queue[0];
+#endif
+	return f;
+}
+
+static void gif_queue_push(gif_writer_state *s, gif_frame *f) {
+#ifdef HAVE_PTHREAD
+	(void) f; // always the slot after the queued frames
+	pthread_mutex_lock(&s->queue_lock);
+	s->queue_count++;
+	pthread_cond_signal(&s->queue_cond);
+	pthread_mutex_unlock(&s->queue_lock);
+#else
+	gif_writer_encode_frame(s, f);
+#endif
+}
+
+static void gif_writer_write_header(gif_writer_state *s) {
 	fwrite("GIF89a", 6, 1, s->file);
 	fput16le(s->file, s->screen_width * s->char_width * (s->screen_width <= 40 ? 2 : 1));
 	fput16le(s->file, s->screen_height * s->char_height);
@@ -210,9 +342,7 @@ gif_writer_state *gif_writer_start(const char *filename, bool optimize, bool pad
 
 	// write global color table
 	// if (!s->optimize_lcts) { // Uncomment if going back to always emitting LCTs
-	u32 *palette = zzt_get_palette();
-	memcpy(s->global_palette, palette, 16 * sizeof(u32));
-	gif_write_palette(s, palette, s->pad_palette ? 32 : 16);
+	gif_write_palette(s, s->global_palette, s->pad_palette ? 32 : 16);
 
 	// write netscape looping extension
 	fputc('!', s->file); // extension
@@ -223,31 +353,120 @@ gif_writer_state *gif_writer_start(const char *filename, bool optimize, bool pad
 	fputc(1, s->file); // sub block ID
 	fput16le(s->file, 0xFFFF); // unlimited repetitions
 	fputc(0x00, s->file); // block terminator
+}
+
+static u32 gif_time_units(double time_ms) {
+	return (u32) ((time_ms / 10.0) + 0.5);
+}
+
+gif_writer_state *gif_writer_start(const char *filename, bool optimize, bool pad_palette) {
+	return gif_writer_start_segment(filename, optimize, pad_palette, zzt_get_palette(), 0, GIF_WRITER_HEADER | GIF_WRITER_TRAILER);
+}
+
+gif_writer_state *gif_writer_start_segment(const char *filename, bool optimize, bool pad_palette, u32 *global_palette, double time_ms, int flags) {
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL) return NULL;
+
+	gif_writer_state *s = malloc(sizeof(gif_writer_state));
+	memset(s, 0, sizeof(gif_writer_state));
+
+	zzt_get_charset(&s->char_width, &s->char_height);
+	zzt_get_screen_size(&s->screen_width, &s->screen_height);
+	
+	s->file = file;
+	s->flags = flags;
+	setvbuf(s->file, s->vbuf, _IOFBF, 65536);
 
+	// prepare internal flags
+	s->force_full_redraw = true;
+	s->optimize = optimize;
+	s->pad_palette = pad_palette;
+	s->optimize_lcts = true;
+	
+	// the first image of a continuation segment starts with its own frame
+	s->time_ms = time_ms;
+	s->image_time = gif_time_units(time_ms);
+	s->image_time_set = (flags & GIF_WRITER_HEADER) != 0;
+	memcpy(s->global_palette, global_palette, 16 * sizeof(u32));
+
+	if (flags & GIF_WRITER_HEADER) {
+		gif_writer_write_header(s);
+	}
+
+	s->pending_charset_change = true;
+	s->queue = malloc(sizeof(gif_frame) * GIF_QUEUE_SIZE);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&s->queue_lock, NULL);
+	pthread_cond_init(&s->queue_cond, NULL);
+	if (s->queue == NULL || pthread_create(&s->thread, NULL, gif_writer_thread, s) != 0) {
+		fprintf(stderr, "Could not start GIF encoder thread!\n");
+		pthread_cond_destroy(&s->queue_cond);
+		pthread_mutex_destroy(&s->queue_lock);
+		free(s->queue);
+		fclose(s->file);
+		free(s);
+		return NULL;
+	}
+#else
+	if (s->queue == NULL) {
+		fclose(s->file);
+		free(s);
+		return NULL;
+	}
+#endif
+
+	zzt_register_vram_dirty(&s->vram_dirty);
 	return s;
 }
 
-static void gif_writer_write_delay(gif_writer_state *s) {
+static void gif_writer_write_delay(gif_writer_state *s, u32 time) {
 	if (s->file_delay_loc > 0) {
 		size_t curr_loc = ftell(s->file);
 		fseek(s->file, s->file_delay_loc, SEEK_SET);
-		fput16le(s->file, s->accumulated_delay >> 16);
+		int delay = time - s->image_time;
+		// pay back the time spent showing partial multi-rectangle frames
+		if (s->delay_debt > 0 && delay > GIF_SUBIMAGE_DELAY) {
+			int paid = delay - GIF_SUBIMAGE_DELAY;
+			if (paid > s->delay_debt) paid = s->delay_debt;
+			delay -= paid;
+			s->delay_debt -= paid;
+		}
+		fput16le(s->file, delay);
 		fseek(s->file, curr_loc, SEEK_SET);
 
-		// Preserve fraction of GIF delay
-		s->accumulated_delay &= 0xFFFF;
+		s->image_time = time;
 		s->file_delay_loc = 0;
 	}
 }
 
 void gif_writer_stop(gif_writer_state *s) {
+	gif_writer_stop_at(s, s->time_ms);
+}
+
+void gif_writer_stop_at(gif_writer_state *s, double time_ms) {
+	zzt_unregister_vram_dirty(&s->vram_dirty);
+
+#ifdef HAVE_PTHREAD
+	// let the encoder drain the queue
+	pthread_mutex_lock(&s->queue_lock);
+	s->thread_quit = true;
+	pthread_cond_signal(&s->queue_cond);
+	pthread_mutex_unlock(&s->queue_lock);
+	pthread_join(s->thread, NULL);
+	pthread_cond_destroy(&s->queue_cond);
+	pthread_mutex_destroy(&s->queue_lock);
+#endif
+
 	// terminate file
-	gif_writer_write_delay(s);
-	fputc(';', s->file);
+	gif_writer_write_delay(s, gif_time_units(time_ms));
+	if (s->flags & GIF_WRITER_TRAILER) {
+		fputc(';', s->file);
+	}
 
 	// clean up
 	fclose(s->file);
 	free(s->vbuf);
+	free(s->queue);
 	if (s->draw_buffer != NULL) free(s->draw_buffer);
 	free(s);
 }
@@ -261,29 +480,115 @@ static u8* gif_alloc_draw_buffer(gif_writer_state *s, int pixel_count) {
 	return s->draw_buffer;
 }
 
-static u8 vram_difference[2000 >> 3];
+// render_software_paletted_range() offers no context pointer; each encoder
+// thread only ever renders its own state's difference map.
+static _Thread_local u8 *vram_difference;
 
 static bool can_draw_char_vram_difference(int x, int y) {
 	return (vram_difference[y * 10 + (x >> 3)] & (1 << (x & 7))) != 0;
 }
 
-void gif_writer_frame(gif_writer_state *s, u32 pit_ticks) {
-	s->accumulated_delay += (u32) ((zzt_get_pit_tick_ms() * 6553.6) + 0.5);
-	u32 palette_optimized[16];
+typedef struct {
+	int x1, y1, x2, y2;
+	int changed; // number of changed cells inside
+} gif_rect;
 
-	int new_screen_w, new_screen_h, new_char_w, new_char_h;
-	zzt_get_screen_size(&new_screen_w, &new_screen_h);
-	u8 *charset = zzt_get_charset(&new_char_w, &new_char_h);
-	u32 *palette = zzt_get_palette();
-	u8 *video = zzt_get_ram() + 0xB8000;
-	bool blink = zzt_get_blink() != 0;
-	bool blink_active = false;
-	if (blink) {
-		int blink_pits = (int) (zzt_get_active_blink_duration_ms() / zzt_get_pit_tick_ms());
-		if (blink_pits > 0) {
-			blink_active = blink && ((pit_ticks / blink_pits) & 1);
+static int gif_rect_cost(gif_rect *r, int cell_pixels, bool use_transparency) {
+	int area = (r->x2 - r->x1 + 1) * (r->y2 - r->y1 + 1);
+	int unchanged = area - r->changed;
+	if (use_transparency) {
+		unchanged /= GIF_TRANSPARENT_CELL_RATIO;
+	}
+	return (r->changed + unchanged) * cell_pixels + GIF_RECT_OVERHEAD;
+}
+
+static void gif_rect_merge(gif_rect *r, gif_rect *o) {
+	if (o->changed == 0) return;
+	if (r->changed == 0) {
+		*r = *o;
+		return;
+	}
+	if (r->x1 > o->x1) r->x1 = o->x1;
+	if (r->y1 > o->y1) r->y1 = o->y1;
+	if (r->x2 < o->x2) r->x2 = o->x2;
+	if (r->y2 < o->y2) r->y2 = o->y2;
+	r->changed += o->changed;
+}
+
+// Tries every cut between two consecutive lines (rows or columns), given the
+// tight bounds of each line's changes. Updates best_cost, a and b if a cut
+// cheaper than best_cost was found.
+static bool gif_rect_split_lines(gif_rect *lines, int count, int *best_cost, gif_rect *a, gif_rect *b, int cell_pixels, bool use_transparency) {
+	gif_rect head[80];
+	gif_rect tail;
+	bool found = false;
+
+	head[0] = lines[0];
+	for (int i = 1; i < count; i++) {
+		head[i] = head[i - 1];
+		gif_rect_merge(&head[i], &lines[i]);
+	}
+
+	memset(&tail, 0, sizeof(gif_rect));
+	for (int i = count - 1; i > 0; i--) {
+		gif_rect_merge(&tail, &lines[i]);
+		if (head[i - 1].changed == 0 || tail.changed == 0) continue;
+
+		int cost = gif_rect_cost(&head[i - 1], cell_pixels, use_transparency) + gif_rect_cost(&tail, cell_pixels, use_transparency);
+		if (cost < *best_cost) {
+			*best_cost = cost;
+			*a = head[i - 1];
+			*b = tail;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+static bool gif_rect_split(gif_rect *r, int *best_cost, gif_rect *a, gif_rect *b, int cell_pixels, bool use_transparency) {
+	gif_rect rows[50];
+	gif_rect cols[80];
+	int w = r->x2 - r->x1 + 1;
+	int h = r->y2 - r->y1 + 1;
+
+	memset(rows, 0, h * sizeof(gif_rect));
+	memset(cols, 0, w * sizeof(gif_rect));
+	for (int y = r->y1; y <= r->y2; y++) {
+		for (int x = r->x1; x <= r->x2; x++) {
+			if (can_draw_char_vram_difference(x, y)) {
+				gif_rect cell = {x, y, x, y, 1};
+				gif_rect_merge(&rows[y - r->y1], &cell);
+				gif_rect_merge(&cols[x - r->x1], &cell);
+			}
 		}
 	}
+
+	bool found = gif_rect_split_lines(rows, h, best_cost, a, b, cell_pixels, use_transparency);
+	found |= gif_rect_split_lines(cols, w, best_cost, a, b, cell_pixels, use_transparency);
+	return found;
+}
+
+static void gif_writer_encode_frame(gif_writer_state *s, gif_frame *f) {
+	u32 palette_optimized[16];
+
+	int new_screen_w = f->screen_width;
+	int new_screen_h = f->screen_height;
+	int new_char_w = f->char_width;
+	int new_char_h = f->char_height;
+	u8 *charset = s->charset;
+	u32 *palette = f->palette;
+	u8 *video = f->video;
+	bool blink = f->blink;
+	bool blink_active = f->blink_active;
+
+	if (f->charset_changed) {
+		memcpy(s->charset, f->charset, 256 * f->char_height);
+	}
+	if (f->charset_changed || f->palette_changed) {
+		s->force_full_redraw = true;
+	}
+
 	bool requires_lct = memcmp(palette, s->global_palette, 16 * sizeof(u32)) != 0;
 
 	if (!s->optimize
@@ -301,23 +606,33 @@ void gif_writer_frame(gif_writer_state *s, u32 pit_ticks) {
 	int cy1 = s->screen_height - 1;
 	int cx2 = 0;
 	int cy2 = 0;
+	int changed_cells = 0;
 
 	bool optimize_lcts = s->optimize_lcts && requires_lct && !s->force_full_redraw;
 	bool use_transparency = s->optimize && s->pad_palette && !s->force_full_redraw;
 	int bit_depth = s->pad_palette ? 5 : 4;
+	int x_mul = s->screen_width <= 40 ? 2 : 1;
 
 	// calculate cx/cy/cw/ch boundaries and new prev_video state
 	u8 *old_vram = s->prev_video;
 	u8 *new_vram = video;
-	u8 *vram_diff_ptr = vram_difference;
-	if (use_transparency) {
-		memset(vram_difference, 0, sizeof(vram_difference));
-	}
+	u8 *vram_diff_ptr = s->vram_difference;
+	memset(s->vram_difference, 0, sizeof(s->vram_difference));
+	vram_difference = s->vram_difference;
 	u16 used_palette_colors = 0;
 	u8 used_palette_map[17];
 
-	for (int cy = 0; cy < s->screen_height; cy++) {
+	// a cell which was not written can only change with the blink phase
+	bool check_all = s->force_full_redraw || blink != s->prev_blink || blink_active != s->prev_blink_active;
+	s->prev_blink = blink;
+	s->prev_blink_active = blink_active;
+
+	for (int cy = 0; cy < s->screen_height && (check_all || f->video_dirty_any); cy++) {
 		for (int cx = 0; cx < s->screen_width; cx++, old_vram += 2, new_vram += 2) {
+			int cell = cy * s->screen_width + cx;
+			if (!check_all && !(f->video_dirty[cell >> 3] & (1 << (cell & 7)))) {
+				continue;
+			}
 			u8 nv_chr = new_vram[0];
 			u8 nv_col = new_vram[1];
 			if (blink && ((nv_col & 0x80) != 0)) {
@@ -338,36 +653,63 @@ void gif_writer_frame(gif_writer_state *s, u32 pit_ticks) {
 					used_palette_colors |= (1 << (nv_col & 0x0F));
 					used_palette_colors |= (1 << (nv_col >> 4));
 				}
-				if (use_transparency) {
-					vram_diff_ptr[cx >> 3] |= (1 << (cx & 7));
-				}
+				vram_diff_ptr[cx >> 3] |= (1 << (cx & 7));
+				changed_cells++;
 			}
 		}
 		vram_diff_ptr += 80 >> 3;
 	}
 
-	if (s->force_full_redraw) {
-		cx1 = 0;
-		cy1 = 0;
-		cx2 = s->screen_width - 1;
-		cy2 = s->screen_height - 1;
-	}
-
-	int px = cx1 * s->char_width * (s->screen_width <= 40 ? 2 : 1);
-	int py = cy1 * s->char_height;
-	int pw = (cx2 - cx1 + 1) * s->char_width * (s->screen_width <= 40 ? 2 : 1);
-	int ph = (cy2 - cy1 + 1) * s->char_height;
+	gif_rect rects[GIF_MAX_RECTS];
+	int rect_count = 1;
 
-	if (pw <= 0 || ph <= 0) {
-		if ((s->accumulated_delay >> 16) >= 32000) {
+	if (s->force_full_redraw) {
+		rects[0].x1 = 0;
+		rects[0].y1 = 0;
+		rects[0].x2 = s->screen_width - 1;
+		rects[0].y2 = s->screen_height - 1;
+	} else if (changed_cells == 0) {
+		if ((f->time - s->image_time) >= 32000) {
 			// failsafe
-			px = 0; py = 0;
-			pw = s->char_width * (s->screen_width <= 40 ? 2 : 1); ph = s->char_height;
-			cx1 = 0; cy1 = 0;
-			cx2 = 0; cy2 = 0;
+			memset(&rects[0], 0, sizeof(gif_rect));
 		} else {
 			return;
 		}
+	} else {
+		int cell_pixels = s->char_width * x_mul * s->char_height;
+		rects[0].x1 = cx1;
+		rects[0].y1 = cy1;
+		rects[0].x2 = cx2;
+		rects[0].y2 = cy2;
+		rects[0].changed = changed_cells;
+
+		// greedily split off disjoint clusters of changes while that is
+		// estimated to be cheaper than encoding the larger rectangle; not
+		// before earlier sub-image delays are paid back, so that playback
+		// cannot fall behind indefinitely
+		while (rect_count < GIF_MAX_RECTS && s->delay_debt == 0) {
+			int best_gain = 0;
+			int best_i = -1;
+			gif_rect best_a, best_b;
+
+			for (int i = 0; i < rect_count; i++) {
+				gif_rect a, b;
+				int cost = gif_rect_cost(&rects[i], cell_pixels, use_transparency);
+				int split_cost = cost;
+				if (gif_rect_split(&rects[i], &split_cost, &a, &b, cell_pixels, use_transparency)
+					&& (cost - split_cost) > best_gain)
+				{
+					best_gain = cost - split_cost;
+					best_i = i;
+					best_a = a;
+					best_b = b;
+				}
+			}
+
+			if (best_i < 0) break;
+			rects[best_i] = best_a;
+			rects[rect_count++] = best_b;
+		}
 	}
 
 	if (optimize_lcts) {
@@ -389,61 +731,121 @@ void gif_writer_frame(gif_writer_state *s, u32 pit_ticks) {
 		if (bit_depth < 3) bit_depth = 3;
 	}
 
-	u8 *pixels = gif_alloc_draw_buffer(s, pw * ph);
-	if (use_transparency) {
-		memset(pixels, 0x10, pw * ph);
+	if (!s->image_time_set) {
+		s->image_time = f->time;
+		s->image_time_set = true;
 	}
-	render_software_paletted_range(pixels, s->screen_width, s->screen_height, -1, RENDER_BLINK_OFF, s->prev_video, charset, s->char_width, s->char_height,
-		cx1, cy1, cx2, cy2, use_transparency ? can_draw_char_vram_difference : NULL);
-
-	gif_writer_write_delay(s);
+	gif_writer_write_delay(s, f->time);
+
+	for (int ri = 0; ri < rect_count; ri++) {
+		gif_rect *r = &rects[ri];
+		int px = r->x1 * s->char_width * x_mul;
+		int py = r->y1 * s->char_height;
+		int pw = (r->x2 - r->x1 + 1) * s->char_width * x_mul;
+		int ph = (r->y2 - r->y1 + 1) * s->char_height;
+
+		u8 *pixels = gif_alloc_draw_buffer(s, pw * ph);
+		if (use_transparency) {
+			memset(pixels, 0x10, pw * ph);
+		}
+		render_software_paletted_range(pixels, s->screen_width, s->screen_height, -1, RENDER_BLINK_OFF, s->prev_video, charset, s->char_width, s->char_height,
+			r->x1, r->y1, r->x2, r->y2, use_transparency ? can_draw_char_vram_difference : NULL);
+
+		// write GCE
+		fputc('!', s->file); // extension
+		fputc(0xF9, s->file); // graphic control extension
+		fputc(4, s->file); // size
+		fputc(GIF_GCE_DISPOSE_IGNORE | (use_transparency ? GIF_GCE_TRANSPARENCY_INDEX : 0), s->file); // flags
+		if (ri < rect_count - 1) {
+			fput16le(s->file, GIF_SUBIMAGE_DELAY); // delay time
+			s->delay_debt += GIF_SUBIMAGE_DELAY;
+		} else {
+			s->file_delay_loc = ftell(s->file);
+			fput16le(s->file, 11); // delay time (temporary)
+		}
+		fputc(optimize_lcts ? used_palette_map[0x10] : ((bit_depth >= 5) ? 0x10 : 0), s->file); // transparent color index
+		fputc(0x00, s->file); // block terminator
+
+		// write image descriptor
+		fputc(',', s->file); // extension
+		fput16le(s->file, px); // X pos
+		fput16le(s->file, py); // Y pos
+		fput16le(s->file, pw); // width
+		fput16le(s->file, ph); // height
+		fputc(requires_lct ? GIF_IMAGE_LOCAL_COLOR_MAP | GIF_IMAGE_LCM_DEPTH(bit_depth) : 0x00, s->file); // flags
+
+		if (requires_lct) {
+			gif_write_palette(s, optimize_lcts ? palette_optimized : palette, 1 << bit_depth);
+		}
 
-	// write GCE
-	fputc('!', s->file); // extension
-	fputc(0xF9, s->file); // graphic control extension
-	fputc(4, s->file); // size
-	fputc(GIF_GCE_DISPOSE_IGNORE | (use_transparency ? GIF_GCE_TRANSPARENCY_INDEX : 0), s->file); // flags
-	s->file_delay_loc = ftell(s->file);
-	fput16le(s->file, 11); // delay time (temporary)
-	fputc(optimize_lcts ? used_palette_map[0x10] : ((bit_depth >= 5) ? 0x10 : 0), s->file); // transparent color index
-	fputc(0x00, s->file); // block terminatorcd 
-
-	// write image descriptor
-	fputc(',', s->file); // extension
-	fput16le(s->file, px); // X pos
-	fput16le(s->file, py); // Y pos
-	fput16le(s->file, pw); // width
-	fput16le(s->file, ph); // height
-	fputc(requires_lct ? GIF_IMAGE_LOCAL_COLOR_MAP | GIF_IMAGE_LCM_DEPTH(bit_depth) : 0x00, s->file); // flags
-
-	if (requires_lct) {
-		gif_write_palette(s, optimize_lcts ? palette_optimized : palette, 1 << bit_depth);
-	}
-
-	lzw_init(&s->lzw, 1 << bit_depth, s->file);
-	if (optimize_lcts) {
-		for (int iy = 0; iy < ph; iy++) {
-			for (int ix = 0; ix < pw; ix++, pixels++) {
-				lzw_emit(&s->lzw, used_palette_map[*pixels], s->file);
+		lzw_init(&s->lzw, 1 << bit_depth, s->file);
+		if (optimize_lcts) {
+			for (int iy = 0; iy < ph; iy++) {
+				for (int ix = 0; ix < pw; ix++, pixels++) {
+					lzw_emit(&s->lzw, used_palette_map[*pixels], s->file);
+				}
 			}
-		}
-	} else {
-		for (int iy = 0; iy < ph; iy++) {
-			for (int ix = 0; ix < pw; ix++, pixels++) {
-				lzw_emit(&s->lzw, *pixels, s->file);
+		} else {
+			for (int iy = 0; iy < ph; iy++) {
+				for (int ix = 0; ix < pw; ix++, pixels++) {
+					lzw_emit(&s->lzw, *pixels, s->file);
+				}
 			}
 		}
+		lzw_finish(&s->lzw, s->file);
+
+		fputc(0x00, s->file); // block terminator
 	}
-	lzw_finish(&s->lzw, s->file);
 
-	fputc(0x00, s->file); // block terminator
 	s->force_full_redraw = false;
 }
 
+void gif_writer_frame(gif_writer_state *s, u32 pit_ticks) {
+	s->time_ms += zzt_get_pit_tick_ms();
+	gif_frame *f = gif_queue_reserve(s);
+	if (f == NULL) {
+		return;
+	}
+
+	f->time = gif_time_units(s->time_ms);
+
+	zzt_get_screen_size(&f->screen_width, &f->screen_height);
+	u8 *charset = zzt_get_charset(&f->char_width, &f->char_height);
+	memcpy(f->palette, zzt_get_palette(), 16 * sizeof(u32));
+	memcpy(f->video, zzt_get_ram() + 0xB8000, f->screen_width * f->screen_height * 2);
+
+	f->blink = zzt_get_blink() != 0;
+	f->blink_active = false;
+	if (f->blink) {
+		int blink_pits = (int) (zzt_get_active_blink_duration_ms() / zzt_get_pit_tick_ms());
+		if (blink_pits > 0) {
+			f->blink_active = (pit_ticks / blink_pits) & 1;
+		}
+	}
+
+	f->charset_changed = s->pending_charset_change;
+	if (f->charset_changed) {
+		memcpy(f->charset, charset, 256 * f->char_height);
+	}
+	f->palette_changed = s->pending_palette_change;
+	s->pending_charset_change = false;
+	s->pending_palette_change = false;
+
+	// only cleared once a frame is queued, so writes carry over dropped frames
+	zzt_update_vram_dirty();
+	f->video_dirty_any = s->vram_dirty.any;
+	if (f->video_dirty_any) {
+		memcpy(f->video_dirty, s->vram_dirty.cells, sizeof(f->video_dirty));
+	}
+	zzt_clear_vram_dirty(&s->vram_dirty);
+
+	gif_queue_push(s, f);
+}
+
 void gif_writer_on_charset_change(gif_writer_state *s) {
-	s->force_full_redraw = true;
+	s->pending_charset_change = true;
 }
 
 void gif_writer_on_palette_change(gif_writer_state *s) {
-	s->force_full_redraw = true;
+	s->pending_palette_change = true;
 }
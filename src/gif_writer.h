@@ -27,8 +27,19 @@
 
 typedef struct s_gif_writer_state gif_writer_state;
 
+// Segment flags. A complete GIF is made of a segment with GIF_WRITER_HEADER,
+// any number of segments without either flag, then one with GIF_WRITER_TRAILER,
+// concatenated. Every segment starts with a full redraw, and the frame times
+// of consecutive segments must continue each other.
+#define GIF_WRITER_HEADER 0x01
+#define GIF_WRITER_TRAILER 0x02
+// Wait for the encoder thread instead of dropping frames.
+#define GIF_WRITER_NO_DROP 0x04
+
 gif_writer_state *gif_writer_start(const char *filename, bool optimize, bool pad_palette);
+gif_writer_state *gif_writer_start_segment(const char *filename, bool optimize, bool pad_palette, u32 *global_palette, double time_ms, int flags);
 void gif_writer_stop(gif_writer_state *s);
+void gif_writer_stop_at(gif_writer_state *s, double time_ms);
 void gif_writer_frame(gif_writer_state *s, u32 pit_ticks);
 void gif_writer_on_charset_change(gif_writer_state *s);
 void gif_writer_on_palette_change(gif_writer_state *s);
@@ -0,0 +1,645 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "png_writer.h"
+
+// Scanlines are filtered with a per-row minimum sum of absolute differences
+// heuristic, then compressed with a single-pass hash chain LZ77 matcher and
+// dynamic Huffman blocks.
+
+#define PNG_WINDOW_SIZE 32768
+#define PNG_HASH_BITS 15
+#define PNG_MAX_CHAIN 16
+#define PNG_MIN_MATCH 4
+#define PNG_MAX_MATCH 258
+#define PNG_BLOCK_SYMBOLS 32768
+
+#define PNG_LITLEN_CODES 286
+#define PNG_DIST_CODES 30
+#define PNG_CODELEN_CODES 19
+
+typedef struct {
+	u16 litlen; // literal byte, or match length
+	u16 dist; // 0 for literals
+} png_lz_symbol;
+
+typedef struct s_png_writer_state {
+	u8 *filtered;
+	size_t filtered_size;
+	u8 *rows; // current and previous packed scanline
+	size_t rows_size;
+
+	u8 *out;
+	size_t out_len;
+	size_t out_size;
+	u64 bits;
+	int bit_count;
+
+	u32 *hash_head; // position + 1, 0 if empty
+	u32 *hash_prev;
+	png_lz_symbol *symbols;
+
+	u32 crc_table[256];
+} png_writer_state;
+
+static const u8 codelen_order[PNG_CODELEN_CODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+png_writer_state *png_writer_create(void) {
+	png_writer_state *s = malloc(sizeof(png_writer_state));
+	if (s == NULL) return NULL;
+	memset(s, 0, sizeof(png_writer_state));
+
+	s->hash_head = malloc(sizeof(u32) << PNG_HASH_BITS);
+	s->hash_prev = malloc(sizeof(u32) * PNG_WINDOW_SIZE);
+	s->symbols = malloc(sizeof(png_lz_symbol) * PNG_BLOCK_SYMBOLS);
+	if (s->hash_head == NULL || s->hash_prev == NULL || s->symbols == NULL) {
+		png_writer_free(s);
+		return NULL;
+	}
+
+	for (int i = 0; i < 256; i++) {
+		u32 c = i;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+		}
+		s->crc_table[i] = c;
+	}
+	return s;
+}
+
+void png_writer_free(png_writer_state *s) {
+	free(s->filtered);
+	free(s->rows);
+	free(s->out);
+	free(s->hash_head);
+	free(s->hash_prev);
+	free(s->symbols);
+	free(s);
+}
+
+static bool png_reserve(u8 **buffer, size_t *size, size_t required) {
+	if (*size < required) {
+		size_t new_size = *size > 0 ? *size : 4096;
+		while (new_size < required) new_size *= 2;
+		u8 *new_buffer = realloc(*buffer, new_size);
+		if (new_buffer == NULL) return false;
+		*buffer = new_buffer;
+		*size = new_size;
+	}
+	return true;
+}
+
+// bit output (LSB first)
+
+static inline void png_put_bits(png_writer_state *s, u32 value, int count) {
+	s->bits |= ((u64) value) << s->bit_count;
+	s->bit_count += count;
+	while (s->bit_count >= 8) {
+		s->out[s->out_len++] = s->bits;
+		s->bits >>= 8;
+		s->bit_count -= 8;
+	}
+}
+
+static void png_align_bits(png_writer_state *s) {
+	if (s->bit_count > 0) {
+		png_put_bits(s, 0, 8 - s->bit_count);
+	}
+}
+
+// Huffman codes
+
+static void png_huffman_lengths(const u32 *freq, int count, int max_bits, u8 *lengths) {
+	int symbols[PNG_LITLEN_CODES];
+	u32 weight[PNG_LITLEN_CODES * 2];
+	int parent[PNG_LITLEN_CODES * 2];
+	int depth[PNG_LITLEN_CODES * 2];
+	int bl_count[16];
+	int n = 0;
+
+	memset(lengths, 0, count);
+	for (int i = 0; i < count; i++) {
+		if (freq[i] > 0) {
+			// insertion sort by ascending frequency
+			int j = n++;
+			while (j > 0 && freq[symbols[j - 1]] > freq[i]) {
+				symbols[j] = symbols[j - 1];
+				j--;
+			}
+			symbols[j] = i;
+		}
+	}
+
+	if (n == 0) return;
+	if (n == 1) {
+		// pad with an unused symbol; inflaters reject incomplete code sets
+		lengths[symbols[0]] = 1;
+		lengths[symbols[0] == 0 ? 1 : 0] = 1;
+		return;
+	}
+
+	// two-queue construction: leaves are sorted, and so are the new nodes
+	for (int i = 0; i < n; i++) {
+		weight[i] = freq[symbols[i]];
+	}
+	int leaf = 0, node = n, next = n;
+	for (int k = 0; k < n - 1; k++) {
+		int pick[2];
+		for (int j = 0; j < 2; j++) {
+			if (leaf < n && (node >= next || weight[leaf] <= weight[node])) {
+				pick[j] = leaf++;
+			} else {
+				pick[j] = node++;
+			}
+		}
+		weight[next] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = next;
+		parent[pick[1]] = next;
+		next++;
+	}
+
+	depth[next - 1] = 0;
+	for (int i = next - 2; i >= 0; i--) {
+		depth[i] = depth[parent[i]] + 1;
+	}
+
+	// clamp to max_bits, then repair the Kraft sum by demoting shorter codes
+	memset(bl_count, 0, sizeof(bl_count));
+	for (int i = 0; i < n; i++) {
+		bl_count[depth[i] > max_bits ? max_bits : depth[i]]++;
+	}
+	u32 total = 0;
+	for (int i = max_bits; i > 0; i--) {
+		total += ((u32) bl_count[i]) << (max_bits - i);
+	}
+	while (total != (1U << max_bits)) {
+		bl_count[max_bits]--;
+		for (int i = max_bits - 1; i > 0; i--) {
+			if (bl_count[i] > 0) {
+				bl_count[i]--;
+				bl_count[i + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	// the least frequent symbols get the longest codes
+	int k = 0;
+	for (int i = max_bits; i > 0; i--) {
+		for (int j = bl_count[i]; j > 0; j--) {
+			lengths[symbols[k++]] = i;
+		}
+	}
+}
+
+static void png_huffman_codes(const u8 *lengths, int count, u16 *codes) {
+	int bl_count[16];
+	u16 next_code[16];
+	u16 code = 0;
+
+	memset(bl_count, 0, sizeof(bl_count));
+	for (int i = 0; i < count; i++) {
+		bl_count[lengths[i]]++;
+	}
+	bl_count[0] = 0;
+	for (int bits = 1; bits < 16; bits++) {
+		code = (code + bl_count[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int len = lengths[i];
+		if (len > 0) {
+			// deflate sends Huffman codes most significant bit first
+			u16 c = next_code[len]++;
+			u16 r = 0;
+			for (int j = 0; j < len; j++, c >>= 1) {
+				r = (r << 1) | (c & 1);
+			}
+			codes[i] = r;
+		}
+	}
+}
+
+// length and distance codes
+
+static inline int png_length_code(int length, int *extra_bits, int *extra) {
+	int v = length - 3;
+	if (v < 8) {
+		*extra_bits = 0;
+		*extra = 0;
+		return 257 + v;
+	} else if (length == PNG_MAX_MATCH) {
+		*extra_bits = 0;
+		*extra = 0;
+		return 285;
+	} else {
+		int hb = highest_bit_index(v);
+		*extra_bits = hb - 2;
+		*extra = v & ((1 << (hb - 2)) - 1);
+		return 257 + ((hb - 1) << 2) + ((v >> (hb - 2)) & 3);
+	}
+}
+
+static inline int png_dist_code(int dist, int *extra_bits, int *extra) {
+	int v = dist - 1;
+	if (v < 4) {
+		*extra_bits = 0;
+		*extra = 0;
+		return v;
+	} else {
+		int hb = highest_bit_index(v);
+		*extra_bits = hb - 1;
+		*extra = v & ((1 << (hb - 1)) - 1);
+		return (hb << 1) + ((v >> (hb - 1)) & 1);
+	}
+}
+
+static bool png_deflate_block(png_writer_state *s, int symbol_count, bool final) {
+	u32 litlen_freq[PNG_LITLEN_CODES];
+	u32 dist_freq[PNG_DIST_CODES];
+	u32 codelen_freq[PNG_CODELEN_CODES];
+	u8 lengths[PNG_LITLEN_CODES + PNG_DIST_CODES];
+	u8 codelen_lengths[PNG_CODELEN_CODES];
+	u16 litlen_codes[PNG_LITLEN_CODES];
+	u16 dist_codes[PNG_DIST_CODES];
+	u16 codelen_codes[PNG_CODELEN_CODES];
+	u8 rle[PNG_LITLEN_CODES + PNG_DIST_CODES];
+	u8 rle_extra[PNG_LITLEN_CODES + PNG_DIST_CODES];
+	int rle_count = 0;
+	int extra_bits, extra;
+
+	// worst case: 15+5+15+13 bits per symbol, plus the block header
+	if (!png_reserve(&s->out, &s->out_size, s->out_len + symbol_count * 6 + 1024)) {
+		return false;
+	}
+
+	memset(litlen_freq, 0, sizeof(litlen_freq));
+	memset(dist_freq, 0, sizeof(dist_freq));
+	memset(codelen_freq, 0, sizeof(codelen_freq));
+	for (int i = 0; i < symbol_count; i++) {
+		png_lz_symbol *sym = &s->symbols[i];
+		if (sym->dist == 0) {
+			litlen_freq[sym->litlen]++;
+		} else {
+			litlen_freq[png_length_code(sym->litlen, &extra_bits, &extra)]++;
+			dist_freq[png_dist_code(sym->dist, &extra_bits, &extra)]++;
+		}
+	}
+	litlen_freq[256] = 1;
+
+	png_huffman_lengths(litlen_freq, PNG_LITLEN_CODES, 15, lengths);
+	png_huffman_lengths(dist_freq, PNG_DIST_CODES, 15, lengths + PNG_LITLEN_CODES);
+
+	int hlit = PNG_LITLEN_CODES;
+	while (hlit > 257 && lengths[hlit - 1] == 0) hlit--;
+	int hdist = PNG_DIST_CODES;
+	while (hdist > 1 && lengths[PNG_LITLEN_CODES + hdist - 1] == 0) hdist--;
+
+	png_huffman_codes(lengths, PNG_LITLEN_CODES, litlen_codes);
+	png_huffman_codes(lengths + PNG_LITLEN_CODES, PNG_DIST_CODES, dist_codes);
+
+	// run-length encode the code lengths of both trees
+	if (hlit < PNG_LITLEN_CODES) {
+		memmove(lengths + hlit, lengths + PNG_LITLEN_CODES, hdist);
+	}
+	int total = hlit + hdist;
+	for (int i = 0; i < total;) {
+		u8 v = lengths[i];
+		int run = 1;
+		while ((i + run) < total && lengths[i + run] == v) run++;
+		i += run;
+
+		if (v == 0) {
+			while (run >= 11) {
+				int r = run > 138 ? 138 : run;
+				rle[rle_count] = 18;
+				rle_extra[rle_count++] = r - 11;
+				run -= r;
+			}
+			if (run >= 3) {
+				rle[rle_count] = 17;
+				rle_extra[rle_count++] = run - 3;
+				run = 0;
+			}
+		} else {
+			rle[rle_count] = v;
+			rle_extra[rle_count++] = 0;
+			run--;
+			while (run >= 3) {
+				int r = run > 6 ? 6 : run;
+				rle[rle_count] = 16;
+				rle_extra[rle_count++] = r - 3;
+				run -= r;
+			}
+		}
+		while (run-- > 0) {
+			rle[rle_count] = v;
+			rle_extra[rle_count++] = 0;
+		}
+	}
+
+	for (int i = 0; i < rle_count; i++) {
+		codelen_freq[rle[i]]++;
+	}
+	png_huffman_lengths(codelen_freq, PNG_CODELEN_CODES, 7, codelen_lengths);
+	png_huffman_codes(codelen_lengths, PNG_CODELEN_CODES, codelen_codes);
+
+	int hclen = PNG_CODELEN_CODES;
+	while (hclen > 4 && codelen_lengths[codelen_order[hclen - 1]] == 0) hclen--;
+
+	// block header
+	png_put_bits(s, final ? 1 : 0, 1);
+	png_put_bits(s, 2, 2); // dynamic Huffman codes
+	png_put_bits(s, hlit - 257, 5);
+	png_put_bits(s, hdist - 1, 5);
+	png_put_bits(s, hclen - 4, 4);
+	for (int i = 0; i < hclen; i++) {
+		png_put_bits(s, codelen_lengths[codelen_order[i]], 3);
+	}
+	for (int i = 0; i < rle_count; i++) {
+		png_put_bits(s, codelen_codes[rle[i]], codelen_lengths[rle[i]]);
+		switch (rle[i]) {
+			case 16: png_put_bits(s, rle_extra[i], 2); break;
+			case 17: png_put_bits(s, rle_extra[i], 3); break;
+			case 18: png_put_bits(s, rle_extra[i], 7); break;
+		}
+	}
+
+	// block data
+	const u8 *litlen_lengths = lengths;
+	const u8 *dist_lengths = lengths + PNG_LITLEN_CODES;
+	// the distance lengths were moved down next to the literal ones above
+	if (hlit < PNG_LITLEN_CODES) {
+		dist_lengths = lengths + hlit;
+	}
+	for (int i = 0; i < symbol_count; i++) {
+		png_lz_symbol *sym = &s->symbols[i];
+		if (sym->dist == 0) {
+			png_put_bits(s, litlen_codes[sym->litlen], litlen_lengths[sym->litlen]);
+		} else {
+			int code = png_length_code(sym->litlen, &extra_bits, &extra);
+			png_put_bits(s, litlen_codes[code], litlen_lengths[code]);
+			if (extra_bits > 0) png_put_bits(s, extra, extra_bits);
+			code = png_dist_code(sym->dist, &extra_bits, &extra);
+			png_put_bits(s, dist_codes[code], dist_lengths[code]);
+			if (extra_bits > 0) png_put_bits(s, extra, extra_bits);
+		}
+	}
+	png_put_bits(s, litlen_codes[256], litlen_lengths[256]);
+
+	return true;
+}
+
+static inline u32 png_hash(const u8 *p) {
+	u32 v = p[0] | (p[1] << 8) | (p[2] << 16) | ((u32) p[3] << 24);
+	return (v * 2654435761U) >> (32 - PNG_HASH_BITS);
+}
+
+static bool png_deflate(png_writer_state *s, const u8 *data, u32 len) {
+	int symbol_count = 0;
+	u32 pos = 0;
+
+	memset(s->hash_head, 0, sizeof(u32) << PNG_HASH_BITS);
+
+	while (pos < len) {
+		u32 max_len = len - pos;
+		u32 best_len = 0;
+		u32 best_dist = 0;
+
+		if (max_len > PNG_MAX_MATCH) max_len = PNG_MAX_MATCH;
+		if (max_len >= PNG_MIN_MATCH) {
+			u32 h = png_hash(data + pos);
+			u32 candidate = s->hash_head[h];
+			int chain = PNG_MAX_CHAIN;
+
+			while (candidate > 0 && chain-- > 0) {
+				u32 cpos = candidate - 1;
+				u32 dist = pos - cpos;
+				if (dist > PNG_WINDOW_SIZE) break;
+				if (data[cpos + best_len] == data[pos + best_len]) {
+					u32 l = 0;
+					while (l < max_len && data[cpos + l] == data[pos + l]) l++;
+					if (l > best_len) {
+						best_len = l;
+						best_dist = dist;
+						if (l == max_len) break;
+					}
+				}
+				candidate = s->hash_prev[cpos & (PNG_WINDOW_SIZE - 1)];
+			}
+
+			s->hash_prev[pos & (PNG_WINDOW_SIZE - 1)] = s->hash_head[h];
+			s->hash_head[h] = pos + 1;
+		}
+
+		png_lz_symbol *sym = &s->symbols[symbol_count++];
+		if (best_len >= PNG_MIN_MATCH) {
+			sym->litlen = best_len;
+			sym->dist = best_dist;
+			// keep the skipped positions matchable
+			u32 end = pos + best_len;
+			for (pos++; pos < end; pos++) {
+				if ((len - pos) >= PNG_MIN_MATCH) {
+					u32 h = png_hash(data + pos);
+					s->hash_prev[pos & (PNG_WINDOW_SIZE - 1)] = s->hash_head[h];
+					s->hash_head[h] = pos + 1;
+				}
+			}
+		} else {
+			sym->litlen = data[pos++];
+			sym->dist = 0;
+		}
+
+		if (symbol_count == PNG_BLOCK_SYMBOLS) {
+			if (!png_deflate_block(s, symbol_count, false)) return false;
+			symbol_count = 0;
+		}
+	}
+
+	return png_deflate_block(s, symbol_count, true);
+}
+
+// scanline filters
+
+static inline u8 png_paeth(u8 a, u8 b, u8 c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	else if (pb <= pc) return b;
+	else return c;
+}
+
+static inline u32 png_filter_cost(u8 v) {
+	return v < 128 ? v : 256 - v;
+}
+
+static void png_filter_row(u8 *out, const u8 *row, const u8 *prior, int len) {
+	u32 cost[5] = {0, 0, 0, 0, 0};
+
+	for (int i = 0; i < len; i++) {
+		u8 a = i > 0 ? row[i - 1] : 0;
+		u8 b = prior[i];
+		u8 c = i > 0 ? prior[i - 1] : 0;
+		cost[0] += png_filter_cost(row[i]);
+		cost[1] += png_filter_cost(row[i] - a);
+		cost[2] += png_filter_cost(row[i] - b);
+		cost[3] += png_filter_cost(row[i] - ((a + b) >> 1));
+		cost[4] += png_filter_cost(row[i] - png_paeth(a, b, c));
+	}
+
+	int filter = 0;
+	for (int i = 1; i < 5; i++) {
+		if (cost[i] < cost[filter]) filter = i;
+	}
+
+	*(out++) = filter;
+	for (int i = 0; i < len; i++) {
+		u8 a = i > 0 ? row[i - 1] : 0;
+		u8 b = prior[i];
+		u8 c = i > 0 ? prior[i - 1] : 0;
+		switch (filter) {
+			case 0: out[i] = row[i]; break;
+			case 1: out[i] = row[i] - a; break;
+			case 2: out[i] = row[i] - b; break;
+			case 3: out[i] = row[i] - ((a + b) >> 1); break;
+			case 4: out[i] = row[i] - png_paeth(a, b, c); break;
+		}
+	}
+}
+
+// chunk output
+
+static u32 png_crc(png_writer_state *s, u32 crc, const u8 *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		crc = s->crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static void png_write_chunk(png_writer_state *s, FILE *output, const char *type, const u8 *data, u32 len) {
+	u32 crc = png_crc(s, 0xFFFFFFFF, (const u8*) type, 4);
+	crc = png_crc(s, crc, data, len);
+	fput32be(output, len);
+	fwrite(type, 4, 1, output);
+	if (len > 0) fwrite(data, len, 1, output);
+	fput32be(output, crc ^ 0xFFFFFFFF);
+}
+
+static u32 png_adler32(const u8 *data, size_t len) {
+	u32 a = 1, b = 0;
+	while (len > 0) {
+		// largest run which cannot overflow b
+		size_t n = len < 5552 ? len : 5552;
+		len -= n;
+		while (n-- > 0) {
+			a += *(data++);
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+int png_writer_write(png_writer_state *s, FILE *output, const u8 *pixels, int width, int height, const u32 *palette) {
+	int row_len = (width + 1) >> 1;
+	size_t filtered_len = (size_t) (row_len + 1) * height;
+	u8 header[13];
+	u8 plte[48];
+
+	if (width <= 0 || height <= 0) return -1;
+	if (!png_reserve(&s->filtered, &s->filtered_size, filtered_len)
+		|| !png_reserve(&s->rows, &s->rows_size, row_len * 2))
+	{
+		return -1;
+	}
+
+	// pack two pixels per byte and filter each scanline
+	u8 *row = s->rows;
+	u8 *prior = s->rows + row_len;
+	memset(prior, 0, row_len);
+	for (int y = 0; y < height; y++) {
+		const u8 *src = pixels + (y * width);
+		for (int x = 0; x < row_len; x++) {
+			u8 hi = src[x * 2] & 0x0F;
+			u8 lo = ((x * 2 + 1) < width) ? (src[x * 2 + 1] & 0x0F) : 0;
+			row[x] = (hi << 4) | lo;
+		}
+		png_filter_row(s->filtered + (size_t) y * (row_len + 1), row, prior, row_len);
+		u8 *tmp = prior;
+		prior = row;
+		row = tmp;
+	}
+
+	// zlib stream: deflate, no preset dictionary, fastest compression level
+	s->out_len = 0;
+	s->bits = 0;
+	s->bit_count = 0;
+	if (!png_reserve(&s->out, &s->out_size, 16)) return -1;
+	s->out[s->out_len++] = 0x78;
+	s->out[s->out_len++] = 0x01;
+	if (!png_deflate(s, s->filtered, filtered_len)) return -1;
+	png_align_bits(s);
+	u32 adler = png_adler32(s->filtered, filtered_len);
+	if (!png_reserve(&s->out, &s->out_size, s->out_len + 4)) return -1;
+	for (int i = 3; i >= 0; i--) {
+		s->out[s->out_len++] = adler >> (i * 8);
+	}
+
+	header[0] = width >> 24;
+	header[1] = width >> 16;
+	header[2] = width >> 8;
+	header[3] = width;
+	header[4] = height >> 24;
+	header[5] = height >> 16;
+	header[6] = height >> 8;
+	header[7] = height;
+	header[8] = 4; // bit depth
+	header[9] = 3; // color type: indexed
+	header[10] = 0; // compression: deflate
+	header[11] = 0; // filter method
+	header[12] = 0; // interlace: none
+
+	for (int i = 0; i < 16; i++) {
+		plte[i * 3] = palette[i] >> 16;
+		plte[i * 3 + 1] = palette[i] >> 8;
+		plte[i * 3 + 2] = palette[i];
+	}
+
+	fwrite("\x89PNG\r\n\x1A\n", 8, 1, output);
+	png_write_chunk(s, output, "IHDR", header, 13);
+	png_write_chunk(s, output, "PLTE", plte, 48);
+	png_write_chunk(s, output, "IDAT", s->out, s->out_len);
+	png_write_chunk(s, output, "IEND", NULL, 0);
+
+	return ferror(output) ? -1 : 0;
+}
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PNG_WRITER_H__
+#define __PNG_WRITER_H__
+
+#include <stdio.h>
+#include "types.h"
+
+// Minimal 4-bit indexed PNG encoder. The state only holds scratch buffers,
+// which are kept between images; reuse it when writing a series of them.
+typedef struct s_png_writer_state png_writer_state;
+
+png_writer_state *png_writer_create(void);
+void png_writer_free(png_writer_state *s);
+// pixels holds one palette index (0-15) per byte, as produced by
+// render_software_paletted(). Returns 0 on success, -1 on failure.
+int png_writer_write(png_writer_state *s, FILE *output, const u8 *pixels, int width, int height, const u32 *palette);
+
+#endif /* __PNG_WRITER_H__ */
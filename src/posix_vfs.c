@@ -33,6 +33,11 @@
 #include "config.h"
 #include "zzt.h"
 
+#if defined(HAVE_OPENDIR) && defined(HAVE_FMEMOPEN)
+#define POSIX_VFS_ZIP
+#include "zip_archive.h"
+#endif
+
 #ifdef HAVE_FTRUNCATE
 #include <unistd.h>
 #endif
@@ -62,6 +67,12 @@ static char vfs_curdir[MAX_FNLEN+1];
 static char vfs_basedir[MAX_FNLEN+1];
 static char vfs_subdir[MAX_VFS_DIRLEN+1];
 
+#ifdef POSIX_VFS_ZIP
+// When a ZIP is mounted, files are looked up on disk first and in the
+// archive second; the on-disk directory thus acts as a writable overlay.
+static zip_archive *vfs_zip = NULL;
+#endif
+
 int vfs_posix_get_file_pointer_count(void) {
 	return file_pointers_size;
 }
@@ -143,15 +154,181 @@ int vfs_chdir(const char *dir) {
 }
 
 #if !defined(HAVE_OPENDIR)
-static void vfs_fix_case(char *fn) { }
+static void vfs_fix_case(char *pathname, bool do_case_fix) { }
+static void vfs_dir_index_clear(void) { }
 int vfs_findfirst(u8* ptr, u16 mask, char* spec) { return -1; }
 int vfs_findnext(u8* ptr) { return -1; }
 #else
-// TODO: This could be optimized better.
-static void vfs_fix_case(char *pathname, bool do_case_fix) {
-	char path_dir[MAX_FNLEN];
+// Case fixing looks names up in a per-directory index, built from a single
+// directory scan and kept until the directory's mtime changes. As mtime has
+// a granularity of one second, an index built in the same second the
+// directory was last modified is "racy" - on a miss, it is rebuilt rather
+// than trusted.
+
+#define VFS_DIR_INDEX_CACHE_SIZE 8
+
+typedef struct {
+	char path[MAX_FNLEN + 1];
+	time_t mtime;
+	time_t built;
+	u32 last_used;
+	int count;
+	int table_mask;
+	int *table; // entry index + 1; 0 = empty slot
+	int *offsets; // into names
+	char *names;
+} vfs_dir_index;
+
+static vfs_dir_index vfs_dir_indexes[VFS_DIR_INDEX_CACHE_SIZE];
+static u32 vfs_dir_index_clock = 0;
+
+static u32 vfs_hash_name(const char *name) {
+	u32 hash = 2166136261U;
+	while (*name != '\0') {
+		char c = *(name++);
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		hash = (hash ^ (u8) c) * 16777619U;
+	}
+	return hash;
+}
+
+static void vfs_dir_index_free(vfs_dir_index *ix) {
+	free(ix->table);
+	free(ix->offsets);
+	free(ix->names);
+	memset(ix, 0, sizeof(vfs_dir_index));
+}
+
+static void vfs_dir_index_clear(void) {
+	for (int i = 0; i < VFS_DIR_INDEX_CACHE_SIZE; i++) {
+		vfs_dir_index_free(&vfs_dir_indexes[i]);
+	}
+}
+
+static bool vfs_dir_index_build(vfs_dir_index *ix, const char *path, time_t mtime) {
 	DIR *dir;
 	struct dirent *entry;
+	int names_size = 1024, names_len = 0;
+	int offsets_size = 64;
+
+	vfs_dir_index_free(ix);
+	dir = opendir(path);
+	if (dir == NULL) {
+		return false;
+	}
+
+	ix->names = malloc(names_size);
+	ix->offsets = malloc(sizeof(int) * offsets_size);
+	if (ix->names == NULL || ix->offsets == NULL) {
+		goto BuildError;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		int len = strlen(entry->d_name) + 1;
+		if ((names_len + len) > names_size) {
+			while ((names_len + len) > names_size) names_size *= 2;
+			char *new_names = realloc(ix->names, names_size);
+			if (new_names == NULL) goto BuildError;
+			ix->names = new_names;
+		}
+		if (ix->count >= offsets_size) {
+			offsets_size *= 2;
+			int *new_offsets = realloc(ix->offsets, sizeof(int) * offsets_size);
+			if (new_offsets == NULL) goto BuildError;
+			ix->offsets = new_offsets;
+		}
+		memcpy(ix->names + names_len, entry->d_name, len);
+		ix->offsets[ix->count++] = names_len;
+		names_len += len;
+	}
+	closedir(dir);
+	dir = NULL;
+
+	// open addressing, kept at most half full; colliding names stay in
+	// directory order along the probe chain
+	ix->table_mask = 15;
+	while (ix->table_mask < ix->count * 2) ix->table_mask = (ix->table_mask << 1) | 1;
+	ix->table = calloc(ix->table_mask + 1, sizeof(int));
+	if (ix->table == NULL) {
+		goto BuildError;
+	}
+	for (int i = 0; i < ix->count; i++) {
+		u32 slot = vfs_hash_name(ix->names + ix->offsets[i]) & ix->table_mask;
+		while (ix->table[slot] != 0) slot = (slot + 1) & ix->table_mask;
+		ix->table[slot] = i + 1;
+	}
+
+	strncpy(ix->path, path, MAX_FNLEN);
+	ix->path[MAX_FNLEN] = 0;
+	ix->mtime = mtime;
+	ix->built = time(NULL);
+	return true;
+
+BuildError:
+	if (dir != NULL) {
+		closedir(dir);
+	}
+	vfs_dir_index_free(ix);
+	return false;
+}
+
+static vfs_dir_index *vfs_dir_index_get(const char *path, bool rebuild) {
+	struct stat dir_stat;
+	vfs_dir_index *ix = NULL;
+
+	if (stat(path, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) {
+		return NULL;
+	}
+
+	for (int i = 0; i < VFS_DIR_INDEX_CACHE_SIZE; i++) {
+		if (vfs_dir_indexes[i].table != NULL && strcmp(vfs_dir_indexes[i].path, path) == 0) {
+			ix = &vfs_dir_indexes[i];
+			break;
+		}
+	}
+
+	if (ix == NULL) {
+		// evict the least recently used index
+		ix = &vfs_dir_indexes[0];
+		for (int i = 1; i < VFS_DIR_INDEX_CACHE_SIZE; i++) {
+			if (vfs_dir_indexes[i].last_used < ix->last_used) {
+				ix = &vfs_dir_indexes[i];
+			}
+		}
+		rebuild = true;
+	} else if (ix->mtime != dir_stat.st_mtime) {
+		rebuild = true;
+	}
+
+	if (rebuild && !vfs_dir_index_build(ix, path, dir_stat.st_mtime)) {
+		return NULL;
+	}
+	ix->last_used = ++vfs_dir_index_clock;
+	return ix;
+}
+
+// Exact matches win; otherwise, the first case-insensitive match in
+// directory order.
+static const char *vfs_dir_index_find(vfs_dir_index *ix, const char *filename) {
+	u32 slot = vfs_hash_name(filename) & ix->table_mask;
+	const char *result = NULL;
+
+	while (ix->table[slot] != 0) {
+		const char *name = ix->names + ix->offsets[ix->table[slot] - 1];
+		if (strcmp(filename, name) == 0) {
+			return name;
+		} else if (result == NULL && strcasecmp(filename, name) == 0) {
+			result = name;
+		}
+		slot = (slot + 1) & ix->table_mask;
+	}
+	return result;
+}
+
+static void vfs_fix_case(char *pathname, bool do_case_fix) {
+	char path_dir[MAX_FNLEN];
+	vfs_dir_index *ix;
+	const char *match;
 
 	char *last_path_sep = NULL;
 	char *filename = NULL;
@@ -170,20 +347,26 @@ static void vfs_fix_case(char *pathname, bool do_case_fix) {
 		strncpy(path_dir, vfs_curdir, MAX_FNLEN);
 		vfs_path_cat(path_dir, pathname, MAX_FNLEN);
 		*last_path_sep = PATH_SEP;
-		dir = opendir(path_dir);
 		filename = last_path_sep + 1;
 	} else {
-		dir = opendir(vfs_curdir);
+		strncpy(path_dir, vfs_curdir, MAX_FNLEN);
 		filename = pathname;
 	}
-	if (dir != NULL) {
-		while ((entry = readdir(dir)) != NULL) {
-			if (strcasecmp(filename, entry->d_name) == 0) {
-				strncpy(filename, entry->d_name, strlen(filename));
-				break;
-			}
+
+	ix = vfs_dir_index_get(path_dir, false);
+	if (ix == NULL) {
+		return;
+	}
+	match = vfs_dir_index_find(ix, filename);
+	if (match == NULL && (ix->built - ix->mtime) <= 1) {
+		ix = vfs_dir_index_get(path_dir, true);
+		if (ix == NULL) {
+			return;
 		}
-		closedir(dir);
+		match = vfs_dir_index_find(ix, filename);
+	}
+	if (match != NULL) {
+		strncpy(filename, match, strlen(filename));
 	}
 }
 
@@ -197,6 +380,19 @@ typedef struct {
 	char name[MAX_VFS_FNLEN + 1];
 } vfs_dirent;
 
+static bool vfs_spec_matches(const char *name, const char *spec) {
+	int spec_len = spec != NULL ? strlen(spec) : 0;
+	if (spec_len > 0) {
+		if (strlen(name) < spec_len) return false;
+		if (strcasecmp(name + strlen(name) - spec_len, spec) != 0) return false;
+	}
+	return true;
+}
+
+static bool vfs_mask_matches(u16 attr, u16 mask) {
+	return ((~mask) & (~attr)) == (~mask);
+}
+
 static vfs_dirent vfs_process_entry(const struct dirent *entry, u16 mask, const char *spec) {
 	char path[MAX_FNLEN+1];
 
@@ -217,10 +413,8 @@ static vfs_dirent vfs_process_entry(const struct dirent *entry, u16 mask, const
 	}
 
 	// skip names which don't match spec
-	int spec_len = spec != NULL ? strlen(spec) : 0;
-	if (spec_len > 0) {
-		if (strlen(name) < spec_len) return result;
-		if (strcasecmp(name + strlen(name) - spec_len, spec) != 0) return result;
+	if (!vfs_spec_matches(name, spec)) {
+		return result;
 	}
 
 	// generate attribute mask & compare
@@ -231,7 +425,7 @@ static vfs_dirent vfs_process_entry(const struct dirent *entry, u16 mask, const
 	if (S_ISDIR(entry_stat.st_mode)) {
 		result.attr |= VFS_ATTR_DIR;
 	}
-	if (((~mask) & (~result.attr)) != (~mask)) {
+	if (!vfs_mask_matches(result.attr, mask)) {
 		return result;
 	}
 
@@ -257,6 +451,158 @@ static int vfs_apply_entry(u8* ptr, vfs_dirent *entry) {
 	return 0;
 }
 
+#ifdef POSIX_VFS_ZIP
+static int vfs_zip_dirent_size = 0;
+static int vfs_zip_dirent_count;
+static int vfs_zip_dirent_pos;
+static vfs_dirent* vfs_zip_dirents = NULL;
+
+// Converts a DOS filename to a path within the mounted archive.
+static void vfs_zip_path(char *dest, size_t n, const char *filename) {
+	dest[0] = 0;
+	if (strlen(filename) >= 3 && filename[1] == ':' && filename[2] == '\\') {
+		filename += 3;
+	} else {
+		strncpy(dest, vfs_subdir, n - 1);
+		dest[n - 1] = 0;
+		if (dest[0] != 0 && strlen(dest) < n - 1) {
+			strcat(dest, "/");
+		}
+	}
+	strncat(dest, filename, n - strlen(dest) - 1);
+	for (int i = 0; dest[i] != 0; i++) {
+		if (dest[i] == '\\' || dest[i] == PATH_SEP)
+			dest[i] = '/';
+	}
+}
+
+static FILE *vfs_zip_open(const char *filename, const char *path, bool writable) {
+	char zip_path[MAX_FNLEN];
+	const u8 *data;
+	u32 size;
+	int i;
+
+	vfs_zip_path(zip_path, sizeof(zip_path), filename);
+	i = zip_archive_find(vfs_zip, zip_path);
+	if (i < 0 || zip_archive_is_dir(vfs_zip, i)) {
+		return NULL;
+	}
+	data = zip_archive_data(vfs_zip, i);
+	if (data == NULL) {
+		return NULL;
+	}
+	size = zip_archive_size(vfs_zip, i);
+
+	if (writable) {
+		// copy the entry to the overlay, and open that instead
+		FILE *file = fopen(path, "wb");
+		if (file == NULL) {
+			return NULL;
+		}
+		if (size > 0 && fwrite(data, size, 1, file) != 1) {
+			fclose(file);
+			remove(path);
+			return NULL;
+		}
+		fclose(file);
+		return fopen(path, "r+b");
+	}
+
+	return fmemopen((void*) data, size, "rb");
+}
+
+static bool vfs_zip_add_dirent(vfs_dirent *entry) {
+	vfs_dirent* vfs_dirents_new;
+
+	// earlier entries (from the overlay) take priority
+	for (int i = 0; i < vfs_zip_dirent_count; i++) {
+		if (strcasecmp(vfs_zip_dirents[i].name, entry->name) == 0) {
+			return true;
+		}
+	}
+
+	if (vfs_zip_dirent_count >= vfs_zip_dirent_size) {
+		int new_size = vfs_zip_dirent_size > 0 ? vfs_zip_dirent_size * 2 : 64;
+		vfs_dirents_new = realloc(vfs_zip_dirents, new_size * sizeof(vfs_dirent));
+		if (vfs_dirents_new == NULL) {
+			return false;
+		}
+		vfs_zip_dirents = vfs_dirents_new;
+		vfs_zip_dirent_size = new_size;
+	}
+	vfs_zip_dirents[vfs_zip_dirent_count++] = *entry;
+	return true;
+}
+
+static int vfs_zip_find_strcmp(const void *a, const void *b) {
+	return strcasecmp(((const vfs_dirent *)a)->name, ((const vfs_dirent *)b)->name);
+}
+
+static int vfs_zip_findnext(u8* ptr) {
+	if (vfs_zip_dirent_pos < vfs_zip_dirent_count) {
+		return vfs_apply_entry(ptr, &vfs_zip_dirents[vfs_zip_dirent_pos++]);
+	} else {
+		return -1;
+	}
+}
+
+// Lists the overlay directory, followed by the archive's central directory.
+static int vfs_zip_findfirst(u8* ptr, u16 mask, char* spec) {
+	char prefix[MAX_FNLEN];
+	size_t prefix_len;
+	DIR *dir;
+	struct dirent *entry;
+	vfs_dirent result;
+
+	if (spec[0] != '*' || strlen(spec + 1) > MAX_SPECLEN) {
+		return -1;
+	}
+	vfs_zip_dirent_count = 0;
+	vfs_zip_dirent_pos = 0;
+
+	dir = opendir(vfs_curdir);
+	if (dir != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			result = vfs_process_entry(entry, mask, spec + 1);
+			if (result.name[0] != 0 && !vfs_zip_add_dirent(&result)) {
+				break;
+			}
+		}
+		closedir(dir);
+	}
+
+	vfs_zip_path(prefix, sizeof(prefix), "");
+	prefix_len = strlen(prefix);
+	for (int i = 0; i < zip_archive_count(vfs_zip); i++) {
+		const char *name = zip_archive_name(vfs_zip, i);
+		const char *name_sep;
+		size_t name_len;
+
+		if (strncasecmp(name, prefix, prefix_len) != 0) continue;
+		name += prefix_len;
+
+		// deeper entries imply a subdirectory of the current one
+		name_sep = strchr(name, '/');
+		name_len = name_sep != NULL ? (size_t) (name_sep - name) : strlen(name);
+		if (name_len == 0 || name_len > MAX_VFS_FNLEN) continue;
+
+		memcpy(result.name, name, name_len);
+		result.name[name_len] = 0;
+		result.attr = (name_sep != NULL || zip_archive_is_dir(vfs_zip, i)) ? VFS_ATTR_DIR : 0;
+		result.time = 0;
+		result.date = 0;
+		result.size = (result.attr & VFS_ATTR_DIR) ? 0 : zip_archive_size(vfs_zip, i);
+		if (!vfs_spec_matches(result.name, spec + 1) || !vfs_mask_matches(result.attr, mask)) continue;
+		if (!vfs_zip_add_dirent(&result)) break;
+	}
+
+	if (vfs_zip_dirent_count > 0) {
+		qsort(vfs_zip_dirents, vfs_zip_dirent_count, sizeof(vfs_dirent), vfs_zip_find_strcmp);
+	}
+	return vfs_zip_findnext(ptr);
+}
+#endif
+
 #if defined(POSIX_VFS_SORTED_DIRS)
 
 static int vfs_dirent_size;
@@ -276,6 +622,11 @@ int vfs_findfirst(u8* ptr, u16 mask, char* spec) {
 #ifdef DEBUG_VFS
 	fprintf(stderr, "posix vfs: findspec %s in %s\n", spec, vfs_curdir);
 #endif
+#ifdef POSIX_VFS_ZIP
+	if (vfs_zip != NULL) {
+		return vfs_zip_findfirst(ptr, mask, spec);
+	}
+#endif
 
 	if (spec[0] == '*') {
 		if (strlen(spec + 1) > MAX_SPECLEN) {
@@ -318,6 +669,11 @@ FindFirstDirentEarlyExit:
 }
 
 int vfs_findnext(u8* ptr) {
+#ifdef POSIX_VFS_ZIP
+	if (vfs_zip != NULL) {
+		return vfs_zip_findnext(ptr);
+	}
+#endif
 	if (vfs_dirent_pos < vfs_dirent_count) {
 		return vfs_apply_entry(ptr, &vfs_dirents[vfs_dirent_pos++]);
 	} else {
@@ -337,6 +693,11 @@ int vfs_findfirst(u8* ptr, u16 mask, char* spec) {
 #ifdef DEBUG_VFS
 	fprintf(stderr, "posix vfs: findfirst %s in %s\n", spec, vfs_curdir);
 #endif
+#ifdef POSIX_VFS_ZIP
+	if (vfs_zip != NULL) {
+		return vfs_zip_findfirst(ptr, mask, spec);
+	}
+#endif
 
 	vfs_findspec[0] = 0; // clear findspec
 
@@ -356,6 +717,11 @@ int vfs_findfirst(u8* ptr, u16 mask, char* spec) {
 int vfs_findnext(u8* ptr) {
 	vfs_dirent vfs_entry;
 	struct dirent *entry;
+#ifdef POSIX_VFS_ZIP
+	if (vfs_zip != NULL) {
+		return vfs_zip_findnext(ptr);
+	}
+#endif
 	if (vfs_finddir == NULL) {
 		return -1;
 	}
@@ -418,6 +784,7 @@ static int vfs_free_file_pointer(int i, bool user) {
 }
 
 void exit_posix_vfs(void) {
+	vfs_dir_index_clear();
 	if (file_pointers_size > 0) {
 		for (int i = 0; i < file_pointers_size; i++) {
 			vfs_free_file_pointer(i, false);
@@ -429,6 +796,28 @@ void exit_posix_vfs(void) {
 		free(file_pointers);
 		file_pointers_size = 0;
 	}
+#ifdef POSIX_VFS_ZIP
+	zip_archive_close(vfs_zip);
+	vfs_zip = NULL;
+	free(vfs_zip_dirents);
+	vfs_zip_dirents = NULL;
+	vfs_zip_dirent_size = 0;
+#endif
+}
+
+int posix_vfs_mount_zip(const char *filename) {
+#ifdef POSIX_VFS_ZIP
+	zip_archive *z = zip_archive_open(filename);
+	if (z == NULL) {
+		return -1;
+	}
+	zip_archive_close(vfs_zip);
+	vfs_zip = z;
+	return 0;
+#else
+	fprintf(stderr, "posix vfs: ZIP support is not available on this platform\n");
+	return -1;
+#endif
 }
 
 void init_posix_vfs(const char* path, bool debug_enabled) {
@@ -522,6 +911,11 @@ int vfs_open(const char* filename, int mode) {
 
 	mode_str = (mode & 0x10000) ? "w+b" : (((mode & 0x03) == 0) ? "rb" : "r+b");
 	file = fopen(path, mode_str);
+#ifdef POSIX_VFS_ZIP
+	if (file == NULL && vfs_zip != NULL && !(mode & 0x10000)) {
+		file = vfs_zip_open(filename, path, (mode & 0x03) != 0);
+	}
+#endif
 	if (file == NULL) {
 #ifdef DEBUG_VFS
 		fprintf(stderr, "posix vfs: failed to open %s (%s)\n", path, mode_str);
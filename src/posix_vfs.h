@@ -35,6 +35,9 @@ USER_FUNCTION
 void init_posix_vfs(const char* path, bool debug_enabled);
 USER_FUNCTION
 void exit_posix_vfs(void);
+// Serve files from a ZIP archive, with the base directory as a writable
+// overlay. Call before opening any files.
+int posix_vfs_mount_zip(const char *filename);
 USER_FUNCTION
 int vfs_posix_get_file_pointer_count(void);
 USER_FUNCTION
@@ -24,15 +24,20 @@
 #include <stdlib.h>
 #include "render_software.h"
 
-void render_software_rgb(u32 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette) {
-	int pos = 0;
+void render_software_rgb_range(u32 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette,
+	int x1, int y1, int x2, int y2)
+{
+	(void) scr_height; // the range already bounds the rows drawn
+	int x_pitch = (scr_width - (x2 - x1 + 1)) << 1;
 
 	if (row_length < 0) {
-		row_length = scr_width * char_width;
+		row_length = (x2 - x1 + 1) * char_width;
 	}
 
-	for (int y = 0; y < scr_height; y++) {
-		for (int x = 0; x < scr_width; x++, pos += 2) {
+	int pos = (y1 * scr_width + x1) << 1;
+
+	for (int y = y1; y <= y2; y++) {
+		for (int x = x1; x <= x2; x++, pos += 2) {
 			u8 chr = video[pos];
 			u8 col = video[pos + 1];
 
@@ -43,22 +48,27 @@ void render_software_rgb(u32 *buffer, int scr_width, int scr_height, int row_len
 				}
 			}
 
-			u8 bg = col >> 4;
-			u8 fg = col & 0xF;
+			u32 bg = palette[col >> 4];
+			u32 fg = palette[col & 0xF];
 			u8 *char_data = charset + (chr * char_height);
 
 			for (int cy = 0; cy < char_height; cy++, char_data++) {
 				int line = *char_data;
-				int bpos = ((y * char_height + cy) * row_length) + ((x * char_width));
+				int bpos = (((y - y1) * char_height + cy) * row_length) + (((x - x1) * char_width));
 				for (int cx = 0; cx < char_width; cx++, line <<= 1, bpos++) {
-					u32 col = palette[(line & 0x80) ? fg : bg];
-					buffer[bpos] = col;
+					buffer[bpos] = (line & 0x80) ? fg : bg;
 				}
 			}
 		}
+		pos += x_pitch;
 	}
 }
 
+void render_software_rgb(u32 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette) {
+	render_software_rgb_range(buffer, scr_width, scr_height, row_length, flags, video, charset, char_width, char_height, palette,
+		0, 0, scr_width - 1, scr_height - 1);
+}
+
 void render_software_paletted_range(u8 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height,
 	int x1, int y1, int x2, int y2, render_software_char_draw_check_func char_draw_check_func)
 {
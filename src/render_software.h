@@ -33,6 +33,9 @@ typedef bool (*render_software_char_draw_check_func)(int, int);
 USER_FUNCTION
 void render_software_rgb(u32 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette);
 USER_FUNCTION
+void render_software_rgb_range(u32 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette,
+    int x1, int y1, int x2, int y2);
+USER_FUNCTION
 void render_software_paletted(u8 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height);
 USER_FUNCTION
 void render_software_paletted_range(u8 *buffer, int scr_width, int scr_height, int row_length, int flags, u8 *video, u8 *charset, int char_width, int char_height,
@@ -23,111 +23,212 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "util.h"
+#include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "png_writer.h"
 #include "screenshot_writer.h"
 
 #define POS_MUL (scr_width <= 40 ? 2 : 1)
 
-#ifdef USE_LIBPNG
-#include <png.h>
+// Queued screenshots; the caller waits when the encoder thread falls behind.
+#ifdef HAVE_PTHREAD
+#define SCREENSHOT_QUEUE_SIZE 8
+#else
+#define SCREENSHOT_QUEUE_SIZE 1
+#endif
+
+typedef struct {
+	char filename[FILENAME_MAX];
+	int scr_width;
+	int scr_height;
+	int flags;
+	int char_width;
+	int char_height;
+	u32 palette[16];
+	u8 video[80 * 50 * 2];
+	u8 charset[256 * 16];
+} screenshot_job;
+
+typedef struct s_screenshot_writer_state {
+	int type;
+	bool async;
+	int errors;
+
+	u8 *buffer;
+	size_t buffer_size;
+	png_writer_state *png;
+
+	screenshot_job *queue;
+	int queue_head;
+	int queue_count;
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_cond;
+	bool thread_quit;
+#endif
+} screenshot_writer_state;
+
+static int write_screenshot_buffer(FILE *output, int type, png_writer_state *png, u8 *buffer, int scr_width, int scr_height, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette) {
+	int width = char_width * scr_width * POS_MUL;
+	int height = char_height * scr_height;
 
-static int write_screenshot_png(FILE *output, u8 *buffer, u32 *palette, int flags, int width, int height) {
-	png_image image;
-	u8 colormap[48];
+	render_software_paletted(buffer, scr_width, scr_height, -1, flags, video, charset, char_width, char_height);
+
+	switch (type) {
+		case SCREENSHOT_TYPE_PNG:
+			return png_writer_write(png, output, buffer, width, height, palette);
+		default:
+			return -1;
+	}
+}
 
-	memset(&image, 0, sizeof(image));
-	image.version = PNG_IMAGE_VERSION;
-	image.width = width;
-	image.height = height;
-	image.format = PNG_FORMAT_RGB_COLORMAP;
-	image.colormap_entries = 16;
+static void screenshot_writer_encode(screenshot_writer_state *s, screenshot_job *job) {
+	int scr_width = job->scr_width;
+	size_t size = job->char_width * job->char_height * scr_width * POS_MUL * job->scr_height;
+	int result = -1;
 
-	for (int i = 0; i < 16; i++) {
-		colormap[i*3 + 0] = palette[i] >> 16;
-		colormap[i*3 + 1] = palette[i] >> 8;
-		colormap[i*3 + 2] = palette[i] >> 0;
+	if (s->buffer_size < size) {
+		free(s->buffer);
+		s->buffer = malloc(size);
+		s->buffer_size = s->buffer != NULL ? size : 0;
 	}
 
-	return png_image_write_to_stdio(&image, output, 0, buffer, 0, colormap) > 0;
+	FILE *output = fopen(job->filename, "wb");
+	if (output != NULL && s->buffer != NULL) {
+		result = write_screenshot_buffer(output, s->type, s->png, s->buffer, job->scr_width, job->scr_height, job->flags,
+			job->video, job->charset, job->char_width, job->char_height, job->palette);
+	}
+	// buffered data is only written out, and can only fail, on close
+	if (output != NULL && fclose(output) != 0) result = -1;
+	if (result < 0) {
+		// don't leave an empty or truncated image behind
+		remove(job->filename);
+		fprintf(stderr, "Could not write screenshot %s!\n", job->filename);
+		s->errors++;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void *screenshot_writer_thread(void *arg) {
+	screenshot_writer_state *s = (screenshot_writer_state*) arg;
+
+	pthread_mutex_lock(&s->queue_lock);
+	while (true) {
+		while (s->queue_count == 0 && !s->thread_quit) {
+			pthread_cond_wait(&s->queue_cond, &s->queue_lock);
+		}
+		if (s->queue_count == 0) break;
+		screenshot_job *job = &s->queue[s->queue_head];
+		pthread_mutex_unlock(&s->queue_lock);
+
+		screenshot_writer_encode(s, job);
+
+		pthread_mutex_lock(&s->queue_lock);
+		s->queue_head = (s->queue_head + 1) % SCREENSHOT_QUEUE_SIZE;
+		s->queue_count--;
+		pthread_cond_signal(&s->queue_cond);
+	}
+	pthread_mutex_unlock(&s->queue_lock);
+
+	return NULL;
 }
 #endif
 
-static int write_screenshot_bmp(FILE *output, u8 *buffer, u32 *palette, int flags, int width, int height) {
-	int bmp_size = 54 + (4*16) + (width * height / 2);
-
-	// header
-	fputc('B', output);
-	fputc('M', output);
-	fput32le(output, bmp_size);
-	fput32le(output, 0);
-	fput32le(output, 54 + (4*16));
-
-	fput32le(output, 40);
-	fput32le(output, width);
-	fput32le(output, height);
-	fput16le(output, 1);
-	fput16le(output, 4);
-	fput32le(output, 0);
-	fput32le(output, (width * height) / 2);
-
-	// 13-inch monitor at 640x350
-	fput32le(output, width * 1000 / 262);
-	fput32le(output, height * 1000 / 270);
-
-	fput32le(output, 16);
-	fput32le(output, 0);
-
-	// color table
-	for (int i = 0; i < 16; i++) {
-		fputc((palette[i]) & 0xFF, output);
-		fputc((palette[i] >> 8) & 0xFF, output);
-		fputc((palette[i] >> 16) & 0xFF, output);
-		fputc(0, output);
+screenshot_writer_state *screenshot_writer_start(int type, bool async) {
+	screenshot_writer_state *s = malloc(sizeof(screenshot_writer_state));
+	if (s == NULL) return NULL;
+	memset(s, 0, sizeof(screenshot_writer_state));
+
+	s->type = type;
+#ifdef HAVE_PTHREAD
+	s->async = async;
+#endif
+	s->queue = malloc(sizeof(screenshot_job) * SCREENSHOT_QUEUE_SIZE);
+	if (type == SCREENSHOT_TYPE_PNG) {
+		s->png = png_writer_create();
+	}
+	if (s->queue == NULL || (type == SCREENSHOT_TYPE_PNG && s->png == NULL)) {
+		if (s->png != NULL) png_writer_free(s->png);
+		free(s->queue);
+		free(s);
+		return NULL;
 	}
 
-	// pixel data
-	for (int y = 0; y < height; y++) {
-		int pos = (height - 1 - y) * width;
-		for (int x = 0; x < width; x += 2, pos += 2) {
-			fputc((buffer[pos] << 4) | buffer[pos + 1], output);
+#ifdef HAVE_PTHREAD
+	if (s->async) {
+		pthread_mutex_init(&s->queue_lock, NULL);
+		pthread_cond_init(&s->queue_cond, NULL);
+		if (pthread_create(&s->thread, NULL, screenshot_writer_thread, s) != 0) {
+			pthread_cond_destroy(&s->queue_cond);
+			pthread_mutex_destroy(&s->queue_lock);
+			s->async = false;
 		}
 	}
+#endif
 
-	return 0;
+	return s;
 }
 
-int write_screenshot(FILE *output, int type, int scr_width, int scr_height, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette) {
-	void *buffer;
+int screenshot_writer_write(screenshot_writer_state *s, const char *filename, int scr_width, int scr_height, int flags, u8 *video, u8 *charset, int char_width, int char_height, u32 *palette) {
+	screenshot_job *job = &s->queue[0];
 
-	int paletted = (type == SCREENSHOT_TYPE_BMP || type == SCREENSHOT_TYPE_PNG);
-
-	buffer = malloc(char_width * char_height * scr_width * POS_MUL * scr_height * (paletted ? sizeof(u8) : sizeof(u32)));
-	if (buffer == NULL) {
-		return -1;
+#ifdef HAVE_PTHREAD
+	if (s->async) {
+		pthread_mutex_lock(&s->queue_lock);
+		while (s->queue_count >= SCREENSHOT_QUEUE_SIZE) {
+			pthread_cond_wait(&s->queue_cond, &s->queue_lock);
+		}
+		job = &s->queue[(s->queue_head + s->queue_count) % SCREENSHOT_QUEUE_SIZE];
+		pthread_mutex_unlock(&s->queue_lock);
 	}
+#endif
 
-	if (paletted) {
-		render_software_paletted(buffer, scr_width, scr_height, -1, flags, video, charset, char_width, char_height);
-	} else {
-		render_software_rgb(buffer, scr_width, scr_height, -1, flags, video, charset, char_width, char_height, palette);
+	snprintf(job->filename, sizeof(job->filename), "%s", filename);
+	job->scr_width = scr_width;
+	job->scr_height = scr_height;
+	job->flags = flags;
+	job->char_width = char_width;
+	job->char_height = char_height;
+	memcpy(job->palette, palette, sizeof(job->palette));
+	memcpy(job->video, video, scr_width * scr_height * 2);
+	memcpy(job->charset, charset, 256 * char_height);
+
+#ifdef HAVE_PTHREAD
+	if (s->async) {
+		pthread_mutex_lock(&s->queue_lock);
+		s->queue_count++;
+		pthread_cond_signal(&s->queue_cond);
+		pthread_mutex_unlock(&s->queue_lock);
+		return 0;
 	}
+#endif
 
-	int result;
+	int errors = s->errors;
+	screenshot_writer_encode(s, job);
+	return s->errors > errors ? -1 : 0;
+}
 
-	switch (type) {
-		case SCREENSHOT_TYPE_BMP:
-			result = write_screenshot_bmp(output, (u8*) buffer, palette, flags, char_width * scr_width * POS_MUL, char_height * scr_height);
-			break;
-#ifdef USE_LIBPNG
-		case SCREENSHOT_TYPE_PNG:
-			result = write_screenshot_png(output, (u8*) buffer, palette, flags, char_width * scr_width * POS_MUL, char_height * scr_height);
-			break;
-#endif
-		default:
-			result = -1;
-			break;
+int screenshot_writer_stop(screenshot_writer_state *s) {
+#ifdef HAVE_PTHREAD
+	if (s->async) {
+		// let the encoder drain the queue
+		pthread_mutex_lock(&s->queue_lock);
+		s->thread_quit = true;
+		pthread_cond_signal(&s->queue_cond);
+		pthread_mutex_unlock(&s->queue_lock);
+		pthread_join(s->thread, NULL);
+		pthread_cond_destroy(&s->queue_cond);
+		pthread_mutex_destroy(&s->queue_lock);
 	}
+#endif
 
-	free(buffer);
+	int result = s->errors > 0 ? -1 : 0;
+	if (s->png != NULL) png_writer_free(s->png);
+	free(s->buffer);
+	free(s->queue);
+	free(s);
 	return result;
 }
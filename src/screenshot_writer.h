@@ -27,10 +27,17 @@
 #include "config.h"
 #include "render_software.h"
 
-#define SCREENSHOT_TYPE_BMP 0
 #define SCREENSHOT_TYPE_PNG 1
 
-USER_FUNCTION
-int write_screenshot(FILE *output, int type, int scr_width, int scr_height, int flags, u8 *ram, u8 *charset, int char_width, int char_height, u32 *palette);
+// Writes a series of screenshots to files, reusing its buffers. In async
+// mode (if threads are available), the frame is copied and encoded on a
+// background thread. A screenshot which fails to encode is reported on
+// stderr as soon as it is processed, and its file is removed;
+// screenshot_writer_stop returns -1 if any did.
+typedef struct s_screenshot_writer_state screenshot_writer_state;
+
+screenshot_writer_state *screenshot_writer_start(int type, bool async);
+int screenshot_writer_write(screenshot_writer_state *s, const char *filename, int scr_width, int scr_height, int flags, u8 *ram, u8 *charset, int char_width, int char_height, u32 *palette);
+int screenshot_writer_stop(screenshot_writer_state *s);
 
 #endif /* __SCREENSHOT_RENDER_H__ */
@@ -54,6 +54,9 @@
 #ifdef ENABLE_GIF_WRITER
 #include "../gif_writer.h"
 #endif
+#ifdef ENABLE_TRACE_WRITER
+#include "../trace_writer.h"
+#endif
 #ifdef ENABLE_SCREENSHOTS
 #include "../screenshot_writer.h"
 #endif
@@ -124,7 +127,6 @@ int zeta_has_feature(int feature) {
 
 static SDL_AudioDeviceID audio_device;
 static SDL_AudioSpec audio_spec;
-static SDL_mutex *audio_mutex;
 
 static double audio_time;
 #ifdef ENABLE_AUDIO_WRITER
@@ -134,33 +136,43 @@ static audio_writer_state *audio_writer_s = NULL;
 static gif_writer_state *gif_writer_s = NULL;
 static u32 gif_writer_ticks;
 #endif
+#ifdef ENABLE_TRACE_WRITER
+static trace_writer_state *trace_writer_s = NULL;
+#endif
+#ifdef ENABLE_SCREENSHOTS
+static screenshot_writer_state *screenshot_writer_s = NULL;
+#endif
 
 static void audio_callback(void *userdata, Uint8 *stream, int len) {
-	SDL_LockMutex(audio_mutex);
 	audio_stream_generate(zeta_time_ms(), stream, len);
-	SDL_UnlockMutex(audio_mutex);
 }
 
 void speaker_on(int cycles, double freq) {
-	SDL_LockMutex(audio_mutex);
 	audio_stream_append_on(audio_time, cycles, freq);
-	SDL_UnlockMutex(audio_mutex);
 #ifdef ENABLE_AUDIO_WRITER
 	if (audio_writer_s != NULL) {
 		audio_writer_speaker_on(audio_writer_s, audio_time, cycles, freq);
 	}
 #endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_speaker_on(trace_writer_s, audio_time, cycles, freq);
+	}
+#endif
 }
 
 void speaker_off(int cycles) {
-	SDL_LockMutex(audio_mutex);
 	audio_stream_append_off(audio_time, cycles);
-	SDL_UnlockMutex(audio_mutex);
 #ifdef ENABLE_AUDIO_WRITER
 	if (audio_writer_s != NULL) {
 		audio_writer_speaker_off(audio_writer_s, audio_time, cycles);
 	}
 #endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_speaker_off(trace_writer_s, audio_time, cycles);
+	}
+#endif
 }
 
 // used for marking render data updates
@@ -169,6 +181,7 @@ static SDL_mutex *render_data_update_mutex;
 static SDL_mutex *zzt_thread_lock;
 static SDL_cond *zzt_thread_cond;
 static u8 zzt_vram_copy[80*50*2];
+static zzt_vram_dirty render_vram_dirty;
 static u8 zzt_thread_running;
 static atomic_int zzt_renderer_waiting = 0;
 static u8 zzt_turbo = 0;
@@ -183,6 +196,18 @@ static void sdl_pit_tick(void) {
 		gif_writer_frame(gif_writer_s, gif_writer_ticks++);
 		SDL_UnlockMutex(render_data_update_mutex);
 	}
+#endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		SDL_LockMutex(render_data_update_mutex);
+		int result = trace_writer_frame(trace_writer_s, zzt_get_pit_tick_ms());
+		SDL_UnlockMutex(render_data_update_mutex);
+		if (result < 0) {
+			trace_writer_stop(trace_writer_s);
+			trace_writer_s = NULL;
+			fprintf(stderr, "Could not write trace frame - trace writing stopped!\n");
+		}
+	}
 #endif
 	zzt_mark_timer();
 }
@@ -364,6 +389,11 @@ void zeta_update_charset(int width, int height, u8* data) {
 	if (gif_writer_s != NULL) {
 		gif_writer_on_charset_change(gif_writer_s);
 	}
+#endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_on_charset_change(trace_writer_s);
+	}
 #endif
 	SDL_UnlockMutex(render_data_update_mutex);
 }
@@ -376,6 +406,11 @@ void zeta_update_palette(u32* data) {
 	if (gif_writer_s != NULL) {
 		gif_writer_on_palette_change(gif_writer_s);
 	}
+#endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_on_palette_change(trace_writer_s);
+	}
 #endif
 	SDL_UnlockMutex(render_data_update_mutex);
 }
@@ -411,7 +446,6 @@ int main(int argc, char **argv) {
 	render_data_update_mutex = SDL_CreateMutex();
 	zzt_thread_lock = SDL_CreateMutex();
 	zzt_thread_cond = SDL_CreateCond();
-	audio_mutex = SDL_CreateMutex();
 
 	int posix_init_result = posix_zzt_init(argc, argv);
 	if (posix_init_result < 0) {
@@ -507,6 +541,7 @@ int main(int argc, char **argv) {
 	sdl_timer_init();
 
 	int should_render = 1;
+	zzt_register_vram_dirty(&render_vram_dirty);
 
 	while (cont_loop) {
 		if (!zzt_thread_running) { cont_loop = 0; break; }
@@ -516,10 +551,12 @@ int main(int argc, char **argv) {
 		atomic_fetch_sub(&zzt_renderer_waiting, 1);
 
 		u8* ram = zzt_get_ram();
-		should_render = memcmp(ram + 0xB8000, zzt_vram_copy, 80*50*2);
+		zzt_update_vram_dirty();
+		should_render = render_vram_dirty.any;
 		if (should_render) {
 			memcpy(zzt_vram_copy, ram + 0xB8000, 80*50*2);
 			renderer->update_vram(zzt_vram_copy);
+			zzt_clear_vram_dirty(&render_vram_dirty);
 		}
 
 		zzt_mark_frame();
@@ -560,24 +597,25 @@ int main(int argc, char **argv) {
 						if (blink_duration_ms < 0) sflags |= RENDER_BLINK_OFF;
 						else if (sdl_is_blink_phase(zeta_time_ms())) sflags |= RENDER_BLINK_PHASE;
 
-#ifdef USE_LIBPNG
-						int stype = SCREENSHOT_TYPE_PNG;
+						if (screenshot_writer_s == NULL) {
+							screenshot_writer_s = screenshot_writer_start(SCREENSHOT_TYPE_PNG, true);
+						}
 						file = create_inc_file(filename, 23, "screen%d.png", "wb");
-#else
-						int stype = SCREENSHOT_TYPE_BMP;
-						file = create_inc_file(filename, 23, "screen%d.bmp", "wb");
-#endif
 						if (file != NULL) {
-							if (write_screenshot(
-								file, stype,
-								swidth, sheight, sflags,
-								zzt_get_ram() + 0xB8000, zzt_get_charset(NULL, NULL),
-								charw, charh,
-								zzt_get_palette()
-							) < 0) {
+							fclose(file);
+							if (screenshot_writer_s == NULL) {
+								remove(filename);
 								fprintf(stderr, "Could not write screenshot!\n");
+							} else {
+								// failures are reported, and the file removed, by the writer
+								screenshot_writer_write(
+									screenshot_writer_s, filename,
+									swidth, sheight, sflags,
+									zzt_get_ram() + 0xB8000, zzt_get_charset(NULL, NULL),
+									charw, charh,
+									zzt_get_palette()
+								);
 							}
-							fclose(file);
 						}
 						break;
 					}
@@ -637,6 +675,32 @@ int main(int argc, char **argv) {
 					}
 #endif
 
+#ifdef ENABLE_TRACE_WRITER
+					if (event.key.keysym.sym == SDLK_F7 && KEYMOD_CTRL(event.key.keysym.mod)) {
+						// session trace writer
+						SDL_LockMutex(zzt_thread_lock);
+						if (trace_writer_s == NULL) {
+							FILE *file;
+							char filename[24];
+							file = create_inc_file(filename, 23, "trace%d.ztr", "wb");
+							if (file != NULL) {
+								fclose(file);
+								if ((trace_writer_s = trace_writer_start(filename, audio_time)) != NULL) {
+									fprintf(stderr, "Trace writing started [%s].\n", filename);
+								} else {
+									fprintf(stderr, "Could not start trace writing - internal error!\n");
+								}
+							}
+						} else {
+							trace_writer_stop(trace_writer_s);
+							trace_writer_s = NULL;
+							fprintf(stderr, "Trace writing stopped.\n");
+						}
+						SDL_UnlockMutex(zzt_thread_lock);
+						break;
+					}
+#endif
+
 					if (event.key.keysym.scancode == SDL_SCANCODE_RETURN && KEYMOD_ALT(event.key.keysym.mod)) {
 						// Alt+ENTER
 						if (windowed) {
@@ -734,6 +798,11 @@ int main(int argc, char **argv) {
 						zzt_mouse_axis(1, event.motion.yrel);
 					}
 					break;
+				case SDL_WINDOWEVENT:
+					if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+						renderer->update_vram(zzt_vram_copy);
+					}
+					break;
 				case SDL_QUIT:
 					cont_loop = 0;
 					break;
@@ -777,6 +846,22 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		SDL_LockMutex(zzt_thread_lock);
+		trace_writer_stop(trace_writer_s);
+		trace_writer_s = NULL;
+		SDL_UnlockMutex(zzt_thread_lock);
+	}
+#endif
+
+#ifdef ENABLE_SCREENSHOTS
+	if (screenshot_writer_s != NULL) {
+		screenshot_writer_stop(screenshot_writer_s);
+		screenshot_writer_s = NULL;
+	}
+#endif
+
 	zzt_thread_running = 0;
 	if (audio_device != 0) {
 		SDL_CloseAudioDevice(audio_device);
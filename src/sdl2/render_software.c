@@ -31,6 +31,8 @@ static u8* charset_update_data = NULL;
 static u32* palette_update_data = NULL;
 
 static SDL_Texture *playfieldtex = NULL;
+// Holds the second blink phase of blinking cells only; transparent elsewhere.
+static SDL_Texture *blinktex = NULL;
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
 static int charw, charh;
@@ -41,7 +43,266 @@ static int pformat = SDL_PIXELFORMAT_BGRA32;
 #endif
 
 static int force_update;
+static int vram_updated;
 static int last_blink_mode;
+static u8 last_vram[80 * 50 * 2];
+static int blink_cell_count;
+static int last_swidth, last_sheight;
+static int last_w, last_h;
+static uint32_t last_border_color;
+static Uint32 last_draw_time;
+
+#define RENDER_MAX_DIRTY_RECTS 16
+// Without a present, nothing waits for vertical sync; sleep for about a frame instead.
+#define RENDER_IDLE_FRAME_MS 16
+
+typedef struct {
+	int x1, y1, x2, y2;
+	bool blink;
+} render_dirty_rect;
+
+#define RENDER_WORKERS_MAX 7
+// Below this many pixels, waking up the workers costs more than it saves.
+#define RENDER_WORKERS_MIN_PIXELS (320 * 200)
+
+typedef struct {
+	SDL_Thread *thread;
+	SDL_sem *start;
+	int y1, y2;
+} render_worker;
+
+static render_worker render_workers[RENDER_WORKERS_MAX];
+static int render_worker_count;
+static SDL_sem *render_workers_done;
+static bool render_workers_quit;
+
+static struct {
+	u32 *buffer;
+	int row_length;
+	int flags;
+	u8 *vram;
+	int swidth, sheight;
+	int x1, y1, x2;
+} render_job;
+
+static void render_band(int y1, int y2) {
+	render_software_rgb_range(
+		render_job.buffer + ((y1 - render_job.y1) * charh * render_job.row_length),
+		render_job.swidth, render_job.sheight, render_job.row_length, render_job.flags,
+		render_job.vram, charset_update_data,
+		charw, charh,
+		palette_update_data,
+		render_job.x1, y1, render_job.x2, y2
+	);
+}
+
+static int SDLCALL render_worker_func(void *data) {
+	render_worker *worker = (render_worker*) data;
+
+	while (true) {
+		SDL_SemWait(worker->start);
+		if (render_workers_quit) {
+			break;
+		}
+		render_band(worker->y1, worker->y2);
+		SDL_SemPost(render_workers_done);
+	}
+
+	return 0;
+}
+
+static void render_workers_init(void) {
+	int count = SDL_GetCPUCount() - 1;
+	if (count > RENDER_WORKERS_MAX) {
+		count = RENDER_WORKERS_MAX;
+	}
+
+	render_worker_count = 0;
+	render_workers_quit = false;
+	if (count <= 0) {
+		return;
+	}
+
+	render_workers_done = SDL_CreateSemaphore(0);
+	if (render_workers_done == NULL) {
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		render_worker *worker = &render_workers[i];
+		worker->start = SDL_CreateSemaphore(0);
+		if (worker->start == NULL) {
+			break;
+		}
+		worker->thread = SDL_CreateThread(render_worker_func, "Renderer", worker);
+		if (worker->thread == NULL) {
+			SDL_DestroySemaphore(worker->start);
+			break;
+		}
+		render_worker_count++;
+	}
+}
+
+static void render_workers_deinit(void) {
+	render_workers_quit = true;
+	for (int i = 0; i < render_worker_count; i++) {
+		SDL_SemPost(render_workers[i].start);
+		SDL_WaitThread(render_workers[i].thread, NULL);
+		SDL_DestroySemaphore(render_workers[i].start);
+	}
+	render_worker_count = 0;
+
+	if (render_workers_done != NULL) {
+		SDL_DestroySemaphore(render_workers_done);
+		render_workers_done = NULL;
+	}
+}
+
+// Renders the given cell range, split into row bands across the worker pool.
+// Small ranges, or systems without spare cores, are rendered on the calling thread.
+static void render_rgb_range(u32 *buffer, int row_length, int flags, u8 *vram, int swidth, int sheight, int x1, int y1, int x2, int y2) {
+	int rows = y2 - y1 + 1;
+	int bands = render_worker_count + 1;
+
+	render_job.buffer = buffer;
+	render_job.row_length = row_length;
+	render_job.flags = flags;
+	render_job.vram = vram;
+	render_job.swidth = swidth;
+	render_job.sheight = sheight;
+	render_job.x1 = x1;
+	render_job.y1 = y1;
+	render_job.x2 = x2;
+
+	if (bands > rows) {
+		bands = rows;
+	}
+
+	if (bands <= 1 || (rows * charh * (x2 - x1 + 1) * charw) < RENDER_WORKERS_MIN_PIXELS) {
+		render_band(y1, y2);
+		return;
+	}
+
+	int band_y = y1;
+	for (int i = 0; i < bands - 1; i++) {
+		int band_rows = (y2 - band_y + 1) / (bands - i);
+		render_workers[i].y1 = band_y;
+		render_workers[i].y2 = band_y + band_rows - 1;
+		band_y += band_rows;
+		SDL_SemPost(render_workers[i].start);
+	}
+
+	render_band(band_y, y2);
+
+	for (int i = 0; i < bands - 1; i++) {
+		SDL_SemWait(render_workers_done);
+	}
+}
+
+// Compares vram against the last rendered copy, row by row, updating the copy as it goes.
+// Consecutive dirty rows are merged into one rectangle spanning their union.
+static int render_find_dirty_rects(u8 *vram, int swidth, int sheight, render_dirty_rect *rects) {
+	int row_bytes = swidth * 2;
+	int count = 0;
+	int prev_dirty = 0;
+
+	for (int y = 0; y < sheight; y++) {
+		u8 *row = vram + (y * row_bytes);
+		u8 *last_row = last_vram + (y * row_bytes);
+
+		if (!memcmp(row, last_row, row_bytes)) {
+			prev_dirty = 0;
+			continue;
+		}
+
+		int x1 = 0;
+		int x2 = swidth - 1;
+		while (row[x1 * 2] == last_row[x1 * 2] && row[x1 * 2 + 1] == last_row[x1 * 2 + 1]) {
+			x1++;
+		}
+		while (row[x2 * 2] == last_row[x2 * 2] && row[x2 * 2 + 1] == last_row[x2 * 2 + 1]) {
+			x2--;
+		}
+
+		bool blink = false;
+		for (int x = x1; x <= x2; x++) {
+			if (last_row[x * 2 + 1] & 0x80) {
+				blink_cell_count--;
+				blink = true;
+			}
+			if (row[x * 2 + 1] & 0x80) {
+				blink_cell_count++;
+				blink = true;
+			}
+		}
+		memcpy(last_row + (x1 * 2), row + (x1 * 2), (x2 - x1 + 1) * 2);
+
+		if (!prev_dirty && count < RENDER_MAX_DIRTY_RECTS) {
+			rects[count].x1 = x1;
+			rects[count].y1 = y;
+			rects[count].x2 = x2;
+			rects[count].y2 = y;
+			rects[count].blink = blink;
+			count++;
+		} else {
+			render_dirty_rect *rect = &rects[count - 1];
+			if (x1 < rect->x1) rect->x1 = x1;
+			if (x2 > rect->x2) rect->x2 = x2;
+			rect->y2 = y;
+			rect->blink |= blink;
+		}
+		prev_dirty = 1;
+	}
+
+	return count;
+}
+
+static void render_texture_rect(int sflags, u8 *vram, int swidth, int sheight, int x1, int y1, int x2, int y2) {
+	SDL_Rect rect;
+	void *buffer;
+	int pitch;
+
+	rect.x = x1 * charw;
+	rect.y = y1 * charh;
+	rect.w = (x2 - x1 + 1) * charw;
+	rect.h = (y2 - y1 + 1) * charh;
+
+	SDL_LockTexture(playfieldtex, &rect, &buffer, &pitch);
+	render_rgb_range(
+		buffer, pitch / 4, sflags, vram,
+		swidth, sheight,
+		x1, y1, x2, y2
+	);
+	SDL_UnlockTexture(playfieldtex);
+}
+
+// Blinking cells show only their background color in the second phase.
+static void render_blink_rect(u8 *vram, int swidth, int x1, int y1, int x2, int y2) {
+	SDL_Rect rect;
+	void *buffer;
+	int pitch;
+
+	rect.x = x1 * charw;
+	rect.y = y1 * charh;
+	rect.w = (x2 - x1 + 1) * charw;
+	rect.h = (y2 - y1 + 1) * charh;
+
+	SDL_LockTexture(blinktex, &rect, &buffer, &pitch);
+	for (int y = y1; y <= y2; y++) {
+		u8 *row = vram + ((y * swidth + x1) * 2);
+		u32 *line = ((u32*) buffer) + ((y - y1) * charh * (pitch / 4));
+		for (int x = x1; x <= x2; x++, row += 2) {
+			u32 color = (row[1] & 0x80) ? palette_update_data[(row[1] >> 4) & 0x07] : 0;
+			u32 *cell = line + ((x - x1) * charw);
+			for (int cy = 0; cy < charh; cy++, cell += pitch / 4) {
+				for (int cx = 0; cx < charw; cx++) {
+					cell[cx] = color;
+				}
+			}
+		}
+	}
+	SDL_UnlockTexture(blinktex);
+}
 
 static int sdl_render_software_init(const char *window_name, int charw, int charh) {
 	window = SDL_CreateWindow(window_name, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -59,14 +320,21 @@ static int sdl_render_software_init(const char *window_name, int charw, int char
 
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
 
+	render_workers_init();
+
 	force_update = 1;
 	return 0;
 }
 
 static void sdl_render_software_deinit(void) {
+    render_workers_deinit();
+
     if (playfieldtex != NULL) {
         SDL_DestroyTexture(playfieldtex);
     }
+    if (blinktex != NULL) {
+        SDL_DestroyTexture(blinktex);
+    }
 
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -83,7 +351,13 @@ static void sdl_render_software_update_charset(int charw_arg, int charh_arg, u8
             SDL_DestroyTexture(playfieldtex);
         }
 
+        if (blinktex != NULL) {
+            SDL_DestroyTexture(blinktex);
+        }
+
         playfieldtex = SDL_CreateTexture(renderer, pformat, SDL_TEXTUREACCESS_STREAMING, 80*charw, 50*charh);
+        blinktex = SDL_CreateTexture(renderer, pformat, SDL_TEXTUREACCESS_STREAMING, 80*charw, 50*charh);
+        SDL_SetTextureBlendMode(blinktex, SDL_BLENDMODE_BLEND);
     }
 
     force_update = 1;
@@ -96,28 +370,70 @@ static void sdl_render_software_update_palette(u32 *data_arg) {
 
 static void sdl_render_software_draw(u8 *vram, int blink_mode) {
 	SDL_Rect src, dest;
-	void *buffer;
-	int w, h, pitch;
+	render_dirty_rect rects[RENDER_MAX_DIRTY_RECTS];
+	int w, h;
 
 	int swidth, sheight;
 	int sflags = 0;
-	int should_render = force_update || (blink_mode != last_blink_mode);
+	int should_present;
 	zzt_get_screen_size(&swidth, &sheight);
 
 	if (palette_update_data == NULL || charset_update_data == NULL) {
 		return;
 	}
 
-	switch (blink_mode) {
-		case BLINK_MODE_NONE:
-			sflags |= RENDER_BLINK_OFF;
-			break;
-		case BLINK_MODE_2:
-			sflags |= RENDER_BLINK_PHASE;
-			break;
+	// The playfield texture always holds the first blink phase; the second phase
+	// is composited from blinktex, so flipping phases does not re-render anything.
+	bool blink_enabled = blink_mode != BLINK_MODE_NONE;
+	if (!blink_enabled) {
+		sflags |= RENDER_BLINK_OFF;
 	}
 
 	SDL_GetRendererOutputSize(renderer, &w, &h);
+	uint32_t border_color = zzt_get_border_color();
+
+	if (force_update || blink_enabled != (last_blink_mode != BLINK_MODE_NONE) || swidth != last_swidth || sheight != last_sheight) {
+		render_texture_rect(sflags, vram, swidth, sheight, 0, 0, swidth - 1, sheight - 1);
+		if (blink_enabled) {
+			render_blink_rect(vram, swidth, 0, 0, swidth - 1, sheight - 1);
+		}
+		memcpy(last_vram, vram, swidth * sheight * 2);
+		blink_cell_count = 0;
+		for (int i = 1; i < swidth * sheight * 2; i += 2) {
+			if (vram[i] & 0x80) {
+				blink_cell_count++;
+			}
+		}
+		should_present = 1;
+	} else {
+		should_present = vram_updated || w != last_w || h != last_h || border_color != last_border_color
+			|| (blink_mode != last_blink_mode && blink_cell_count > 0);
+		if (vram_updated) {
+			int rect_count = render_find_dirty_rects(vram, swidth, sheight, rects);
+			for (int i = 0; i < rect_count; i++) {
+				render_texture_rect(sflags, vram, swidth, sheight, rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+				if (blink_enabled && rects[i].blink) {
+					render_blink_rect(vram, swidth, rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+				}
+			}
+		}
+	}
+
+	last_blink_mode = blink_mode;
+	last_swidth = swidth;
+	last_sheight = sheight;
+	force_update = 0;
+	vram_updated = 0;
+
+	if (!should_present) {
+		Uint32 elapsed = SDL_GetTicks() - last_draw_time;
+		if (elapsed < RENDER_IDLE_FRAME_MS) {
+			SDL_Delay(RENDER_IDLE_FRAME_MS - elapsed);
+		}
+		last_draw_time = SDL_GetTicks();
+		return;
+	}
+
 	calc_render_area(&dest, w, h, NULL, 0);
 
 	src.x = 0;
@@ -125,27 +441,19 @@ static void sdl_render_software_draw(u8 *vram, int blink_mode) {
 	src.w = swidth * charw;
 	src.h = sheight * charh;
 
-	if (should_render) {
-		SDL_LockTexture(playfieldtex, NULL, &buffer, &pitch);
-		render_software_rgb(
-			buffer,
-			swidth, sheight, pitch / 4, sflags,
-			vram, charset_update_data,
-			charw, charh,
-			palette_update_data
-		);
-		SDL_UnlockTexture(playfieldtex);
-	}
-
-	uint32_t border_color = zzt_get_border_color();
 	SDL_SetRenderDrawColor(renderer, ((border_color >> 16) & 0xFF), ((border_color >> 8) & 0xFF), border_color & 0xFF, SDL_ALPHA_OPAQUE);
 	SDL_RenderClear(renderer);
 	SDL_RenderCopy(renderer, playfieldtex, &src, &dest);
+	if (blink_mode == BLINK_MODE_2 && blink_cell_count > 0) {
+		SDL_RenderCopy(renderer, blinktex, &src, &dest);
+	}
 
 	SDL_RenderPresent(renderer);
 
-	last_blink_mode = blink_mode;
-	force_update = 0;
+	last_w = w;
+	last_h = h;
+	last_border_color = border_color;
+	last_draw_time = SDL_GetTicks();
 }
 
 static SDL_Window *sdl_render_software_get_window(void) {
@@ -153,7 +461,7 @@ static SDL_Window *sdl_render_software_get_window(void) {
 }
 
 static void sdl_render_software_update_vram(u8 *vram) {
-	force_update = 1;
+	vram_updated = 1;
 }
 
 static sdl_render_size sdl_render_software_get_render_size(void) {
@@ -55,6 +55,9 @@
 #ifdef ENABLE_GIF_WRITER
 #include "../gif_writer.h"
 #endif
+#ifdef ENABLE_TRACE_WRITER
+#include "../trace_writer.h"
+#endif
 #ifdef ENABLE_SCREENSHOTS
 #include "../screenshot_writer.h"
 #endif
@@ -124,7 +127,6 @@ int zeta_has_feature(int feature) {
 }
 
 static SDL_AudioStream *audio_stream;
-static SDL_Mutex *audio_mutex;
 
 static double audio_time;
 #ifdef ENABLE_AUDIO_WRITER
@@ -134,40 +136,57 @@ static audio_writer_state *audio_writer_s = NULL;
 static gif_writer_state *gif_writer_s = NULL;
 static u32 gif_writer_ticks;
 #endif
+#ifdef ENABLE_TRACE_WRITER
+static trace_writer_state *trace_writer_s = NULL;
+#endif
+#ifdef ENABLE_SCREENSHOTS
+static screenshot_writer_state *screenshot_writer_s = NULL;
+#endif
 
 static void audio_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount) {
 	if (additional_amount) {
-		uint8_t *data = SDL_stack_alloc(uint8_t, additional_amount);
+		// top the queue up to what the measured callback jitter calls for,
+		// which is just the device's request on a steady machine
+		int queued = total_amount - additional_amount;
+		int amount = audio_stream_get_buffer_target(additional_amount) - queued;
+		if (amount < additional_amount) amount = additional_amount;
+		amount &= ~1;
+
+		uint8_t *data = SDL_stack_alloc(uint8_t, amount);
 		if (data) {
-			SDL_LockMutex(audio_mutex);
-			audio_stream_generate(zeta_time_ms(), data, additional_amount);
-			SDL_UnlockMutex(audio_mutex);
-			SDL_PutAudioStreamData(stream, data, additional_amount);
+			audio_stream_generate(zeta_time_ms(), data, amount);
+			SDL_PutAudioStreamData(stream, data, amount);
 			SDL_stack_free(data);
 		}
 	}
 }
 
 void speaker_on(int cycles, double freq) {
-	SDL_LockMutex(audio_mutex);
 	audio_stream_append_on(audio_time, cycles, freq);
-	SDL_UnlockMutex(audio_mutex);
 #ifdef ENABLE_AUDIO_WRITER
 	if (audio_writer_s != NULL) {
 		audio_writer_speaker_on(audio_writer_s, audio_time, cycles, freq);
 	}
 #endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_speaker_on(trace_writer_s, audio_time, cycles, freq);
+	}
+#endif
 }
 
 void speaker_off(int cycles) {
-	SDL_LockMutex(audio_mutex);
 	audio_stream_append_off(audio_time, cycles);
-	SDL_UnlockMutex(audio_mutex);
 #ifdef ENABLE_AUDIO_WRITER
 	if (audio_writer_s != NULL) {
 		audio_writer_speaker_off(audio_writer_s, audio_time, cycles);
 	}
 #endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_speaker_off(trace_writer_s, audio_time, cycles);
+	}
+#endif
 }
 
 // used for marking render data updates
@@ -176,6 +195,7 @@ static SDL_Mutex *render_data_update_mutex;
 static SDL_Mutex *zzt_thread_lock;
 static SDL_Condition *zzt_thread_cond;
 static u8 zzt_vram_copy[80*50*2];
+static zzt_vram_dirty render_vram_dirty;
 static u8 zzt_thread_running;
 static atomic_int zzt_renderer_waiting = 0;
 static u8 zzt_turbo = 0;
@@ -190,6 +210,18 @@ static void sdl_pit_tick(void) {
 		gif_writer_frame(gif_writer_s, gif_writer_ticks++);
 		SDL_UnlockMutex(render_data_update_mutex);
 	}
+#endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		SDL_LockMutex(render_data_update_mutex);
+		int result = trace_writer_frame(trace_writer_s, zzt_get_pit_tick_ms());
+		SDL_UnlockMutex(render_data_update_mutex);
+		if (result < 0) {
+			trace_writer_stop(trace_writer_s);
+			trace_writer_s = NULL;
+			fprintf(stderr, "Could not write trace frame - trace writing stopped!\n");
+		}
+	}
 #endif
 	zzt_mark_timer();
 }
@@ -376,6 +408,11 @@ void zeta_update_charset(int width, int height, u8* data) {
 	if (gif_writer_s != NULL) {
 		gif_writer_on_charset_change(gif_writer_s);
 	}
+#endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_on_charset_change(trace_writer_s);
+	}
 #endif
 	SDL_UnlockMutex(render_data_update_mutex);
 }
@@ -388,6 +425,11 @@ void zeta_update_palette(u32* data) {
 	if (gif_writer_s != NULL) {
 		gif_writer_on_palette_change(gif_writer_s);
 	}
+#endif
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		trace_writer_on_palette_change(trace_writer_s);
+	}
 #endif
 	SDL_UnlockMutex(render_data_update_mutex);
 }
@@ -424,7 +466,6 @@ int main(int argc, char **argv) {
 	render_data_update_mutex = SDL_CreateMutex();
 	zzt_thread_lock = SDL_CreateMutex();
 	zzt_thread_cond = SDL_CreateCondition();
-	audio_mutex = SDL_CreateMutex();
 
 	int posix_init_result = posix_zzt_init(argc, argv);
 	if (posix_init_result < 0) {
@@ -513,6 +554,7 @@ int main(int argc, char **argv) {
 	sdl_timer_init();
 
 	int should_render = 1;
+	zzt_register_vram_dirty(&render_vram_dirty);
 
 	while (cont_loop) {
 		if (!zzt_thread_running) { cont_loop = 0; break; }
@@ -522,10 +564,12 @@ int main(int argc, char **argv) {
 		atomic_fetch_sub(&zzt_renderer_waiting, 1);
 
 		u8* ram = zzt_get_ram();
-		should_render = memcmp(ram + 0xB8000, zzt_vram_copy, 80*50*2);
+		zzt_update_vram_dirty();
+		should_render = render_vram_dirty.any;
 		if (should_render) {
 			memcpy(zzt_vram_copy, ram + 0xB8000, 80*50*2);
 			renderer->update_vram(zzt_vram_copy);
+			zzt_clear_vram_dirty(&render_vram_dirty);
 		}
 
 		zzt_mark_frame();
@@ -566,24 +610,25 @@ int main(int argc, char **argv) {
 						if (blink_duration_ms < 0) sflags |= RENDER_BLINK_OFF;
 						else if (sdl_is_blink_phase(zeta_time_ms())) sflags |= RENDER_BLINK_PHASE;
 
-#ifdef USE_LIBPNG
-						int stype = SCREENSHOT_TYPE_PNG;
+						if (screenshot_writer_s == NULL) {
+							screenshot_writer_s = screenshot_writer_start(SCREENSHOT_TYPE_PNG, true);
+						}
 						file = create_inc_file(filename, 23, "screen%d.png", "wb");
-#else
-						int stype = SCREENSHOT_TYPE_BMP;
-						file = create_inc_file(filename, 23, "screen%d.bmp", "wb");
-#endif
 						if (file != NULL) {
-							if (write_screenshot(
-								file, stype,
-								swidth, sheight, sflags,
-								zzt_get_ram() + 0xB8000, zzt_get_charset(NULL, NULL),
-								charw, charh,
-								zzt_get_palette()
-							) < 0) {
+							fclose(file);
+							if (screenshot_writer_s == NULL) {
+								remove(filename);
 								fprintf(stderr, "Could not write screenshot!\n");
+							} else {
+								// failures are reported, and the file removed, by the writer
+								screenshot_writer_write(
+									screenshot_writer_s, filename,
+									swidth, sheight, sflags,
+									zzt_get_ram() + 0xB8000, zzt_get_charset(NULL, NULL),
+									charw, charh,
+									zzt_get_palette()
+								);
 							}
-							fclose(file);
 						}
 						break;
 					}
@@ -643,6 +688,32 @@ int main(int argc, char **argv) {
 					}
 #endif
 
+#ifdef ENABLE_TRACE_WRITER
+					if (event.key.key == SDLK_F7 && KEYMOD_CTRL(event.key.mod)) {
+						// session trace writer
+						SDL_LockMutex(zzt_thread_lock);
+						if (trace_writer_s == NULL) {
+							FILE *file;
+							char filename[24];
+							file = create_inc_file(filename, 23, "trace%d.ztr", "wb");
+							if (file != NULL) {
+								fclose(file);
+								if ((trace_writer_s = trace_writer_start(filename, audio_time)) != NULL) {
+									fprintf(stderr, "Trace writing started [%s].\n", filename);
+								} else {
+									fprintf(stderr, "Could not start trace writing - internal error!\n");
+								}
+							}
+						} else {
+							trace_writer_stop(trace_writer_s);
+							trace_writer_s = NULL;
+							fprintf(stderr, "Trace writing stopped.\n");
+						}
+						SDL_UnlockMutex(zzt_thread_lock);
+						break;
+					}
+#endif
+
 					if (event.key.scancode == SDL_SCANCODE_RETURN && KEYMOD_ALT(event.key.mod)) {
 						// Alt+ENTER
 						if (windowed) {
@@ -783,6 +854,9 @@ int main(int argc, char **argv) {
 					else if (event.gbutton.button == SDL_GAMEPAD_BUTTON_DPAD_RIGHT)
 						zzt_joy_axis(0, 0);
 				} break;
+				case SDL_EVENT_WINDOW_EXPOSED:
+					renderer->update_vram(zzt_vram_copy);
+					break;
 				case SDL_EVENT_QUIT:
 					cont_loop = 0;
 					break;
@@ -826,6 +900,22 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+#ifdef ENABLE_TRACE_WRITER
+	if (trace_writer_s != NULL) {
+		SDL_LockMutex(zzt_thread_lock);
+		trace_writer_stop(trace_writer_s);
+		trace_writer_s = NULL;
+		SDL_UnlockMutex(zzt_thread_lock);
+	}
+#endif
+
+#ifdef ENABLE_SCREENSHOTS
+	if (screenshot_writer_s != NULL) {
+		screenshot_writer_stop(screenshot_writer_s);
+		screenshot_writer_s = NULL;
+	}
+#endif
+
 	zzt_thread_running = 0;
 	SDL_StopTextInput(window);
 	if (audio_stream != 0) {
@@ -0,0 +1,618 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Renders a session trace (see trace_format.h) to a GIF, a sequence of
+// screenshots and/or a WAV file, reusing the live recording writers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <unistd.h>
+#include "types.h"
+#include "zzt.h"
+#include "audio_shared.h"
+#include "audio_writer.h"
+#include "gif_writer.h"
+#include "screenshot_writer.h"
+#include "trace_format.h"
+
+#define READ_BUFFER_SIZE 65536
+// GIF segments shorter than this are not worth an extra keyframe.
+#define GIF_MIN_SEGMENT_TICKS 1024
+#define MAX_JOBS 64
+#define REPLAY_VRAM_DIRTY_MAX 4
+
+#define REPLAY_ERROR -1
+
+// Emulator state rebuilt from the trace, one per rendering thread.
+typedef struct {
+	const u8 *data;
+	size_t len;
+	size_t pos;
+
+	u8 *ram;
+	u8 charset[256 * 16];
+	u32 palette[16];
+	int screen_width, screen_height;
+	int char_width, char_height;
+	bool blink;
+	int blink_duration;
+	bool charset_changed;
+	bool palette_changed;
+	zzt_vram_dirty *vram_dirty[REPLAY_VRAM_DIRTY_MAX];
+	int vram_dirty_count;
+
+	double tick_ms; // length of the current tick
+	double time_ms; // time at the start of the current tick
+	u32 ticks;
+
+	audio_writer_state *wav;
+	s64 event_time_us;
+	int event_cycles;
+} trace_replay;
+
+// the writers query the emulator state through zzt.h
+static _Thread_local trace_replay *replay;
+
+void zzt_get_screen_size(int *width, int *height) {
+	if (width != NULL) *width = replay->screen_width;
+	if (height != NULL) *height = replay->screen_height;
+}
+
+u8 *zzt_get_charset(int *width, int *height) {
+	if (width != NULL) *width = replay->char_width;
+	if (height != NULL) *height = replay->char_height;
+	return replay->charset;
+}
+
+u32 *zzt_get_palette(void) {
+	return replay->palette;
+}
+
+u8 *zzt_get_ram(void) {
+	return replay->ram;
+}
+
+int zzt_get_blink(void) {
+	return replay->blink ? 1 : 0;
+}
+
+int zzt_get_active_blink_duration_ms(void) {
+	return replay->blink_duration;
+}
+
+double zzt_get_pit_tick_ms(void) {
+	return replay->tick_ms;
+}
+
+// VRAM records name the changed cells, so they are marked in every
+// registered bitmap as they are applied; there is nothing to collect.
+void zzt_register_vram_dirty(zzt_vram_dirty *d) {
+	memset(d->cells, 0xFF, sizeof(d->cells));
+	d->any = true;
+	d->registered = false;
+	if (replay->vram_dirty_count < REPLAY_VRAM_DIRTY_MAX) {
+		replay->vram_dirty[replay->vram_dirty_count++] = d;
+		d->registered = true;
+	}
+}
+
+void zzt_unregister_vram_dirty(zzt_vram_dirty *d) {
+	for (int i = 0; i < replay->vram_dirty_count; i++) {
+		if (replay->vram_dirty[i] == d) {
+			replay->vram_dirty[i] = replay->vram_dirty[--replay->vram_dirty_count];
+			break;
+		}
+	}
+	d->registered = false;
+}
+
+void zzt_update_vram_dirty(void) {
+}
+
+void zzt_clear_vram_dirty(zzt_vram_dirty *d) {
+	if (d->registered && d->any) {
+		memset(d->cells, 0, sizeof(d->cells));
+		d->any = false;
+	}
+}
+
+static bool replay_init(trace_replay *r, const u8 *data, size_t len) {
+	memset(r, 0, sizeof(trace_replay));
+	r->ram = malloc(0xB8000 + 80 * 50 * 2);
+	if (r->ram == NULL) return false;
+	memset(r->ram + 0xB8000, 0, 80 * 50 * 2);
+
+	r->data = data;
+	r->len = len;
+	r->pos = 5; // magic and version
+	r->screen_width = 80;
+	r->screen_height = 25;
+	r->char_width = 8;
+	r->char_height = 14;
+	r->blink = true;
+	r->blink_duration = 266;
+	r->tick_ms = 55;
+	return true;
+}
+
+static void replay_free(trace_replay *r) {
+	free(r->ram);
+}
+
+static int read_u8(trace_replay *r) {
+	if (r->pos >= r->len) return -1;
+	return r->data[r->pos++];
+}
+
+static const u8 *read_bytes(trace_replay *r, size_t len) {
+	if (r->len - r->pos < len) return NULL;
+	r->pos += len;
+	return r->data + r->pos - len;
+}
+
+static bool read_varint(trace_replay *r, u64 *out) {
+	u64 v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int b = read_u8(r);
+		if (b < 0) return false;
+		v |= ((u64) (b & 0x7F)) << shift;
+		if (!(b & 0x80)) {
+			*out = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool read_svarint(trace_replay *r, s64 *out) {
+	u64 v;
+	if (!read_varint(r, &v)) return false;
+	*out = (v & 1) ? -((s64) (v >> 1)) - 1 : (s64) (v >> 1);
+	return true;
+}
+
+static bool read_vram(trace_replay *r) {
+	u64 runs, skip, len;
+	u64 pos = 0;
+	u64 cells = r->screen_width * r->screen_height;
+	const u8 *data;
+
+	if (!read_varint(r, &runs)) return false;
+	for (u64 i = 0; i < runs; i++) {
+		if (!read_varint(r, &skip) || !read_varint(r, &len)) return false;
+		pos += skip;
+		if (pos + len > cells) return false;
+		if ((data = read_bytes(r, len * 2)) == NULL) return false;
+		memcpy(r->ram + 0xB8000 + pos * 2, data, len * 2);
+		for (int j = 0; j < r->vram_dirty_count; j++) {
+			zzt_vram_dirty *d = r->vram_dirty[j];
+			for (u64 cell = pos; cell < pos + len; cell++) {
+				d->cells[cell >> 3] |= 1 << (cell & 7);
+			}
+			d->any = true;
+		}
+		pos += len;
+	}
+	return true;
+}
+
+// Applies records up to the next tick. Returns TRACE_OP_TICK, TRACE_OP_END
+// or REPLAY_ERROR.
+static int replay_next(trace_replay *r) {
+	while (true) {
+		int op = read_u8(r);
+		const u8 *data;
+		u64 v1, v2;
+		s64 sv;
+		int c;
+
+		switch (op) {
+			case -1:
+			case TRACE_OP_END:
+				return TRACE_OP_END;
+			case TRACE_OP_TICK:
+				if (!read_varint(r, &v1)) return REPLAY_ERROR;
+				r->tick_ms = v1 / 1000.0;
+				return TRACE_OP_TICK;
+			case TRACE_OP_VRAM:
+				if (!read_vram(r)) return REPLAY_ERROR;
+				break;
+			case TRACE_OP_SCREEN:
+				if (!read_varint(r, &v1) || !read_varint(r, &v2) || v1 > 80 || v2 > 50 || v1 == 0 || v2 == 0) return REPLAY_ERROR;
+				r->screen_width = v1;
+				r->screen_height = v2;
+				break;
+			case TRACE_OP_CHARSET:
+				if (!read_varint(r, &v1) || !read_varint(r, &v2) || v1 > 16 || v2 > 16 || v1 == 0 || v2 == 0) return REPLAY_ERROR;
+				if ((data = read_bytes(r, 256 * v2)) == NULL) return REPLAY_ERROR;
+				r->char_width = v1;
+				r->char_height = v2;
+				memcpy(r->charset, data, 256 * v2);
+				r->charset_changed = true;
+				break;
+			case TRACE_OP_PALETTE:
+				if ((data = read_bytes(r, 48)) == NULL) return REPLAY_ERROR;
+				for (int i = 0; i < 16; i++) {
+					r->palette[i] = 0xFF000000 | (data[i * 3] << 16) | (data[i * 3 + 1] << 8) | data[i * 3 + 2];
+				}
+				r->palette_changed = true;
+				break;
+			case TRACE_OP_BLINK:
+				if ((c = read_u8(r)) < 0 || !read_svarint(r, &sv)) return REPLAY_ERROR;
+				r->blink = c != 0;
+				r->blink_duration = sv;
+				break;
+			case TRACE_OP_SPEAKER_ON: {
+				u64 freq_bits = 0;
+				double freq;
+				if (!read_svarint(r, &sv) || !read_varint(r, &v1) || (data = read_bytes(r, 8)) == NULL) return REPLAY_ERROR;
+				for (int i = 7; i >= 0; i--) {
+					freq_bits = (freq_bits << 8) | data[i];
+				}
+				memcpy(&freq, &freq_bits, sizeof(double));
+				r->event_time_us += sv;
+				r->event_cycles = v1;
+				if (r->wav != NULL) audio_writer_speaker_on(r->wav, r->event_time_us / 1000.0, r->event_cycles, freq);
+			} break;
+			case TRACE_OP_SPEAKER_OFF:
+				if (!read_svarint(r, &sv) || !read_varint(r, &v1)) return REPLAY_ERROR;
+				r->event_time_us += sv;
+				r->event_cycles = v1;
+				if (r->wav != NULL) audio_writer_speaker_off(r->wav, r->event_time_us / 1000.0, r->event_cycles);
+				break;
+			default:
+				return REPLAY_ERROR;
+		}
+	}
+}
+
+static void replay_end_tick(trace_replay *r) {
+	r->time_ms += r->tick_ms;
+	r->ticks++;
+	r->charset_changed = false;
+	r->palette_changed = false;
+}
+
+static void replay_gif_frame(trace_replay *r, gif_writer_state *gif) {
+	if (r->charset_changed) gif_writer_on_charset_change(gif);
+	if (r->palette_changed) gif_writer_on_palette_change(gif);
+	gif_writer_frame(gif, r->ticks);
+}
+
+static void write_image(trace_replay *r, screenshot_writer_state *images, const char *prefix) {
+	char filename[FILENAME_MAX];
+	snprintf(filename, sizeof(filename), "%s%06d.png", prefix, r->ticks);
+
+	int flags = 0;
+	if (!r->blink) {
+		flags |= RENDER_BLINK_OFF;
+	} else if (r->blink_duration > 0 && (((long) (r->time_ms / r->blink_duration)) & 1)) {
+		flags |= RENDER_BLINK_PHASE;
+	}
+
+	// failures are reported by screenshot_writer_stop()
+	screenshot_writer_write(images, filename, r->screen_width, r->screen_height, flags,
+		r->ram + 0xB8000, r->charset, r->char_width, r->char_height, r->palette);
+}
+
+static u8 *load_trace(const char *filename, size_t *len) {
+	trace_file file = trace_file_open(filename, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open %s!\n", filename);
+		return NULL;
+	}
+
+	size_t size = READ_BUFFER_SIZE;
+	u8 *data = malloc(size);
+	int read_len;
+	*len = 0;
+	while (data != NULL && (read_len = trace_file_read(file, data + *len, size - *len)) > 0) {
+		*len += read_len;
+		if (*len == size) {
+			u8 *new_data = realloc(data, size * 2);
+			if (new_data == NULL) {
+				free(data);
+				data = NULL;
+				break;
+			}
+			data = new_data;
+			size *= 2;
+		}
+	}
+	trace_file_close(file);
+
+	if (data == NULL) {
+		fprintf(stderr, "Out of memory reading %s!\n", filename);
+		return NULL;
+	}
+	if (*len < 5 || memcmp(data, TRACE_MAGIC, 4) || data[4] != TRACE_VERSION) {
+		fprintf(stderr, "%s is not a supported trace file!\n", filename);
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+typedef struct {
+	const u8 *data;
+	size_t len;
+	const char *filename;
+	bool optimize;
+	u32 *global_palette;
+	u32 first_tick;
+	u32 last_tick; // exclusive
+	bool first, last;
+	bool result;
+} gif_segment;
+
+// Encodes the ticks [first_tick, last_tick) of a trace as a GIF segment,
+// starting with a keyframe; the whole trace is replayed up to that point,
+// which is far cheaper than encoding it.
+static void *render_gif_segment(void *arg) {
+	gif_segment *seg = (gif_segment*) arg;
+	gif_writer_state *gif = NULL;
+	trace_replay r;
+
+	seg->result = false;
+	if (!replay_init(&r, seg->data, seg->len)) return NULL;
+	replay = &r;
+
+	while (replay_next(&r) == TRACE_OP_TICK) {
+		if (r.ticks == seg->first_tick) {
+			int flags = GIF_WRITER_NO_DROP;
+			if (seg->first) flags |= GIF_WRITER_HEADER;
+			if (seg->last) flags |= GIF_WRITER_TRAILER;
+			gif = gif_writer_start_segment(seg->filename, seg->optimize, true, seg->global_palette, r.time_ms, flags);
+			if (gif == NULL) {
+				fprintf(stderr, "Could not open %s!\n", seg->filename);
+				break;
+			}
+		} else if (r.ticks == seg->last_tick) {
+			// the last image lasts until the next segment's first one
+			gif_writer_stop_at(gif, r.time_ms + r.tick_ms);
+			gif = NULL;
+			seg->result = true;
+			break;
+		}
+		if (gif != NULL) {
+			replay_gif_frame(&r, gif);
+		}
+		replay_end_tick(&r);
+	}
+
+	if (gif != NULL) {
+		gif_writer_stop(gif);
+		seg->result = true;
+	}
+	replay_free(&r);
+	return NULL;
+}
+
+static bool append_file(FILE *output, const char *filename) {
+	u8 buffer[READ_BUFFER_SIZE];
+	size_t len;
+	FILE *input = fopen(filename, "rb");
+	if (input == NULL) return false;
+
+	while ((len = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+		if (fwrite(buffer, 1, len, output) != len) {
+			fclose(input);
+			return false;
+		}
+	}
+	fclose(input);
+	return true;
+}
+
+#ifdef HAVE_PTHREAD
+static bool render_gif_parallel(const u8 *data, size_t len, const char *filename, bool optimize, u32 *global_palette, u32 ticks, int segments) {
+	gif_segment seg[MAX_JOBS];
+	pthread_t threads[MAX_JOBS];
+	bool threaded[MAX_JOBS];
+	char part_filenames[MAX_JOBS][FILENAME_MAX];
+	bool result = true;
+
+	for (int i = 0; i < segments; i++) {
+		if (i == 0) {
+			snprintf(part_filenames[i], FILENAME_MAX, "%s", filename);
+		} else {
+			snprintf(part_filenames[i], FILENAME_MAX, "%s.part%d", filename, i);
+		}
+		seg[i].data = data;
+		seg[i].len = len;
+		seg[i].filename = part_filenames[i];
+		seg[i].optimize = optimize;
+		seg[i].global_palette = global_palette;
+		seg[i].first_tick = (u32) (((u64) ticks * i) / segments);
+		seg[i].last_tick = (u32) (((u64) ticks * (i + 1)) / segments);
+		seg[i].first = i == 0;
+		seg[i].last = i == (segments - 1);
+		threaded[i] = pthread_create(&threads[i], NULL, render_gif_segment, &seg[i]) == 0;
+		if (!threaded[i]) {
+			render_gif_segment(&seg[i]);
+		}
+	}
+
+	for (int i = 0; i < segments; i++) {
+		if (threaded[i]) {
+			pthread_join(threads[i], NULL);
+		}
+		result &= seg[i].result;
+	}
+
+	if (result) {
+		FILE *output = fopen(filename, "ab");
+		for (int i = 1; i < segments && result; i++) {
+			result = output != NULL && append_file(output, part_filenames[i]);
+		}
+		if (output != NULL) fclose(output);
+		if (!result) {
+			fprintf(stderr, "Could not join GIF segments into %s!\n", filename);
+		}
+	}
+
+	for (int i = 1; i < segments; i++) {
+		remove(part_filenames[i]);
+	}
+	return result;
+}
+#endif
+
+static void render_help(const char *name) {
+	fprintf(stderr, "Usage: %s [arguments] <trace file>\n", name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Arguments:\n");
+	fprintf(stderr, "  -g []  write an animated GIF\n");
+	fprintf(stderr, "  -G     disable GIF optimizations\n");
+#ifdef HAVE_PTHREAD
+	fprintf(stderr, "  -j []  encode the GIF in up to [] parallel segments (default: CPU count)\n");
+#endif
+	fprintf(stderr, "  -p []  write one PNG per tick, as [prefix]000000.png onwards\n");
+	fprintf(stderr, "  -w []  write a 48 kHz WAV file\n");
+}
+
+int main(int argc, char **argv) {
+	const char *gif_filename = NULL;
+	const char *image_prefix = NULL;
+	const char *wav_filename = NULL;
+	bool gif_optimize = true;
+	int jobs = 1;
+	int c;
+
+#ifdef HAVE_PTHREAD
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	while ((c = getopt(argc, argv, "g:Gj:p:w:h")) >= 0) {
+		switch (c) {
+			case 'g': gif_filename = optarg; break;
+			case 'G': gif_optimize = false; break;
+			case 'j': jobs = atoi(optarg); break;
+			case 'p': image_prefix = optarg; break;
+			case 'w': wav_filename = optarg; break;
+			default:
+				render_help(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc || (gif_filename == NULL && image_prefix == NULL && wav_filename == NULL)) {
+		render_help(argv[0]);
+		return 1;
+	}
+	if (jobs < 1) jobs = 1;
+	if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+
+	size_t len;
+	u8 *data = load_trace(argv[optind], &len);
+	if (data == NULL) {
+		return 1;
+	}
+
+	// the GIF is only encoded inline if it is not split into segments
+	trace_replay r;
+	gif_writer_state *gif = NULL;
+	screenshot_writer_state *images = NULL;
+	bool gif_inline = jobs == 1;
+	u32 global_palette[16];
+	int result = 0;
+	int op;
+
+	if (!replay_init(&r, data, len)) {
+		free(data);
+		return 1;
+	}
+	replay = &r;
+
+	if (wav_filename != NULL) {
+		audio_generate_init();
+		r.wav = audio_writer_start(wav_filename, 0, 48000);
+		if (r.wav == NULL) {
+			fprintf(stderr, "Could not open %s!\n", wav_filename);
+			result = 1;
+		}
+	}
+
+	if (image_prefix != NULL && result == 0) {
+		images = screenshot_writer_start(SCREENSHOT_TYPE_PNG, true);
+		if (images == NULL) {
+			result = 1;
+		}
+	}
+
+	while (result == 0 && (op = replay_next(&r)) == TRACE_OP_TICK) {
+		if (r.ticks == 0) {
+			memcpy(global_palette, r.palette, sizeof(global_palette));
+			if (gif_filename != NULL && gif_inline) {
+				gif = gif_writer_start_segment(gif_filename, gif_optimize, true, global_palette, 0,
+					GIF_WRITER_HEADER | GIF_WRITER_TRAILER | GIF_WRITER_NO_DROP);
+				if (gif == NULL) {
+					fprintf(stderr, "Could not open %s!\n", gif_filename);
+					result = 1;
+					break;
+				}
+			}
+		}
+		if (gif != NULL) {
+			replay_gif_frame(&r, gif);
+		}
+		if (images != NULL) {
+			write_image(&r, images, image_prefix);
+		}
+		replay_end_tick(&r);
+	}
+
+	if (result == 0 && op == REPLAY_ERROR) {
+		fprintf(stderr, "%s: malformed trace, stopping after %d ticks\n", argv[optind], r.ticks);
+	}
+
+	if (gif != NULL) {
+		gif_writer_stop(gif);
+	}
+	if (images != NULL && screenshot_writer_stop(images) < 0) {
+		result = 1;
+	}
+	if (r.wav != NULL) {
+		double end_time = r.event_time_us / 1000.0;
+		audio_writer_stop(r.wav, end_time > r.time_ms ? end_time : r.time_ms, r.event_cycles);
+	}
+
+#ifdef HAVE_PTHREAD
+	if (result == 0 && gif_filename != NULL && !gif_inline && r.ticks > 0) {
+		int segments = r.ticks / GIF_MIN_SEGMENT_TICKS;
+		if (segments > jobs) segments = jobs;
+		if (segments < 1) segments = 1;
+		if (!render_gif_parallel(data, len, gif_filename, gif_optimize, global_palette, r.ticks, segments)) {
+			result = 1;
+		}
+	}
+#endif
+
+	replay_free(&r);
+	free(data);
+	return result;
+}
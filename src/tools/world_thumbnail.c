@@ -0,0 +1,534 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Renders every board of ZZT and Super ZZT worlds to PNG files, parsing the
+// world format directly instead of emulating the game.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "png_writer.h"
+#include "render_software.h"
+
+extern unsigned char res_8x14_bin[];
+
+#define CHAR_WIDTH 8
+#define CHAR_HEIGHT 14
+#define MAX_JOBS 64
+
+#define DRAW_TILE 0
+#define DRAW_TEXT 1
+#define DRAW_LINE 2
+#define DRAW_WEB 3
+#define DRAW_OBJECT 4
+#define DRAW_BOMB 5
+#define DRAW_DUPLICATOR 6
+#define DRAW_TRANSPORTER 7
+#define DRAW_PUSHER 8
+#define DRAW_STONE 9
+
+typedef struct {
+	u8 chr;
+	u8 draw;
+} element_def;
+
+typedef struct {
+	const char *name;
+	int header_size;
+	int board_width;
+	int board_height;
+	int board_name_size;
+	int board_info_size;
+	int stat_size;
+	int element_count;
+	const element_def *elements;
+	u8 element_edge;
+	u8 element_line;
+	u8 element_web; // 0 if none
+	u8 element_text_min;
+} world_format;
+
+// Elements are drawn with their tile's color, as in the game; the exceptions
+// are text (the color byte is the character) and the DRAW_* special cases.
+static const element_def zzt_elements[] = {
+	{' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, // empty, edge, messenger, monitor
+	{2, DRAW_TILE}, {132, DRAW_TILE}, {157, DRAW_TILE}, {4, DRAW_TILE}, // player, ammo, torch, gem
+	{12, DRAW_TILE}, {10, DRAW_TILE}, {232, DRAW_TILE}, {240, DRAW_TILE}, // key, door, scroll, passage
+	{250, DRAW_DUPLICATOR}, {11, DRAW_BOMB}, {127, DRAW_TILE}, {179, DRAW_TILE}, // duplicator, bomb, energizer, star
+	{179, DRAW_TILE}, {'\\', DRAW_TILE}, {248, DRAW_TILE}, {176, DRAW_TILE}, // conveyors, bullet, water
+	{176, DRAW_TILE}, {219, DRAW_TILE}, {178, DRAW_TILE}, {177, DRAW_TILE}, // forest, solid, normal, breakable
+	{254, DRAW_TILE}, {18, DRAW_TILE}, {29, DRAW_TILE}, {178, DRAW_TILE}, // boulder, sliders, fake
+	{' ', DRAW_TILE}, {206, DRAW_TILE}, {197, DRAW_TRANSPORTER}, {206, DRAW_LINE}, // invisible, blink wall, transporter, line
+	{42, DRAW_TILE}, {205, DRAW_TILE}, {153, DRAW_TILE}, {5, DRAW_TILE}, // ricochet, blink ray, bear, ruffian
+	{2, DRAW_OBJECT}, {42, DRAW_TILE}, {94, DRAW_TILE}, {24, DRAW_TILE}, // object, slime, shark, spinning gun
+	{16, DRAW_PUSHER}, {234, DRAW_TILE}, {227, DRAW_TILE}, {186, DRAW_TILE}, // pusher, lion, tiger, blink ray
+	{233, DRAW_TILE}, {'O', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TEXT}, // centipede, unused, text
+	{' ', DRAW_TEXT}, {' ', DRAW_TEXT}, {' ', DRAW_TEXT}, {' ', DRAW_TEXT},
+	{' ', DRAW_TEXT}, {' ', DRAW_TEXT}
+};
+
+static const element_def szt_elements[] = {
+	{' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, // empty, edge, messenger, monitor
+	{2, DRAW_TILE}, {132, DRAW_TILE}, {' ', DRAW_TILE}, {4, DRAW_TILE}, // player, ammo, unused, gem
+	{12, DRAW_TILE}, {10, DRAW_TILE}, {232, DRAW_TILE}, {240, DRAW_TILE}, // key, door, scroll, passage
+	{250, DRAW_DUPLICATOR}, {11, DRAW_BOMB}, {127, DRAW_TILE}, {' ', DRAW_TILE}, // duplicator, bomb, energizer, unused
+	{179, DRAW_TILE}, {'\\', DRAW_TILE}, {' ', DRAW_TILE}, {111, DRAW_TILE}, // conveyors, unused, lava
+	{176, DRAW_TILE}, {219, DRAW_TILE}, {178, DRAW_TILE}, {177, DRAW_TILE}, // forest, solid, normal, breakable
+	{254, DRAW_TILE}, {18, DRAW_TILE}, {29, DRAW_TILE}, {178, DRAW_TILE}, // boulder, sliders, fake
+	{' ', DRAW_TILE}, {206, DRAW_TILE}, {197, DRAW_TRANSPORTER}, {206, DRAW_LINE}, // invisible, blink wall, transporter, line
+	{42, DRAW_TILE}, {' ', DRAW_TILE}, {153, DRAW_TILE}, {5, DRAW_TILE}, // ricochet, unused, bear, ruffian
+	{2, DRAW_OBJECT}, {42, DRAW_TILE}, {' ', DRAW_TILE}, {24, DRAW_TILE}, // object, slime, unused, spinning gun
+	{16, DRAW_PUSHER}, {234, DRAW_TILE}, {227, DRAW_TILE}, {' ', DRAW_TILE}, // pusher, lion, tiger, unused
+	{233, DRAW_TILE}, {'O', DRAW_TILE}, {' ', DRAW_TILE}, {176, DRAW_TILE}, // centipede, unused, floor
+	{30, DRAW_TILE}, {31, DRAW_TILE}, {17, DRAW_TILE}, {16, DRAW_TILE}, // water currents
+	{' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, // unused
+	{' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, {148, DRAW_TILE}, // unused, roton
+	{237, DRAW_TILE}, {229, DRAW_TILE}, {15, DRAW_TILE}, {197, DRAW_WEB}, // dragon pup, pairer, spider, web
+	{'Z', DRAW_STONE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, {' ', DRAW_TILE}, // stone, unused
+	{' ', DRAW_TILE}, {248, DRAW_TILE}, {205, DRAW_TILE}, {186, DRAW_TILE}, // unused, bullet, blink rays
+	{179, DRAW_TILE}, {' ', DRAW_TEXT}, {' ', DRAW_TEXT}, {' ', DRAW_TEXT}, // star, text
+	{' ', DRAW_TEXT}, {' ', DRAW_TEXT}, {' ', DRAW_TEXT}, {' ', DRAW_TEXT}
+};
+
+static const world_format format_zzt = {
+	"ZZT", 512, 60, 25, 50, 86, 33,
+	sizeof(zzt_elements) / sizeof(element_def), zzt_elements,
+	1, 31, 0, 47
+};
+
+static const world_format format_szt = {
+	"Super ZZT", 1024, 96, 80, 60, 28, 25,
+	sizeof(szt_elements) / sizeof(element_def), szt_elements,
+	1, 31, 63, 73
+};
+
+// indexed by connected neighbors: north = 1, south = 2, west = 4, east = 8
+static const u8 line_chars[16] = {
+	249, 208, 210, 186, 181, 188, 187, 185, 198, 200, 201, 204, 205, 202, 203, 206
+};
+static const u8 web_chars[16] = {
+	250, 179, 179, 179, 196, 217, 191, 180, 196, 192, 218, 195, 196, 193, 194, 197
+};
+static const u8 duplicator_chars[6] = {250, 250, 249, 248, 111, 79};
+
+typedef struct {
+	u8 element;
+	u8 color;
+	s16 stat; // -1 if none
+} board_tile;
+
+typedef struct {
+	s16 step_x, step_y;
+	u8 p1;
+} board_stat;
+
+typedef struct {
+	const char *output_dir;
+	png_writer_state *png;
+	u32 palette[16];
+	board_tile *tiles;
+	board_stat *stats;
+	u8 *video;
+	u8 *pixels;
+	int boards_written;
+	int errors;
+} thumbnail_state;
+
+static u16 get16(const u8 *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static bool tile_connects(const world_format *fmt, board_tile *tiles, int x, int y, u8 element) {
+	if (x < 0 || y < 0 || x >= fmt->board_width || y >= fmt->board_height) {
+		return element == fmt->element_line;
+	}
+	u8 e = tiles[y * fmt->board_width + x].element;
+	return e == element || (element == fmt->element_line && e == fmt->element_edge);
+}
+
+static void draw_tile(const world_format *fmt, thumbnail_state *t, int x, int y, u8 *out) {
+	board_tile *tile = &t->tiles[y * fmt->board_width + x];
+	board_stat *stat = tile->stat >= 0 ? &t->stats[tile->stat] : NULL;
+	u8 element = tile->element;
+	u8 chr = ' ';
+	u8 color = tile->color;
+
+	if (element < fmt->element_count) {
+		const element_def *def = &fmt->elements[element];
+		chr = def->chr;
+		switch (def->draw) {
+			case DRAW_TEXT:
+				chr = tile->color;
+				color = (element == fmt->element_count - 1) ? 0x0F : (((element - fmt->element_text_min + 1) << 4) | 0x0F);
+				break;
+			case DRAW_LINE:
+			case DRAW_WEB: {
+				int v = 0;
+				if (tile_connects(fmt, t->tiles, x, y - 1, element)) v |= 1;
+				if (tile_connects(fmt, t->tiles, x, y + 1, element)) v |= 2;
+				if (tile_connects(fmt, t->tiles, x - 1, y, element)) v |= 4;
+				if (tile_connects(fmt, t->tiles, x + 1, y, element)) v |= 8;
+				chr = (def->draw == DRAW_LINE ? line_chars : web_chars)[v];
+			} break;
+			case DRAW_OBJECT:
+				if (stat != NULL) chr = stat->p1;
+				break;
+			case DRAW_BOMB:
+				if (stat != NULL && stat->p1 > 1) chr = '0' + stat->p1;
+				break;
+			case DRAW_DUPLICATOR:
+				if (stat != NULL && stat->p1 <= 5) chr = duplicator_chars[stat->p1];
+				break;
+			case DRAW_TRANSPORTER:
+				if (stat != NULL) {
+					if (stat->step_x == 0) chr = stat->step_y < 0 ? '^' : 'v';
+					else chr = stat->step_x < 0 ? '(' : ')';
+				}
+				break;
+			case DRAW_PUSHER:
+				if (stat != NULL) {
+					if (stat->step_x == 1) chr = 16;
+					else if (stat->step_x == -1) chr = 17;
+					else if (stat->step_y == -1) chr = 30;
+					else chr = 31;
+				}
+				break;
+			case DRAW_STONE:
+				// random in the game; pick a stable letter instead
+				chr = 'A' + ((x * 7 + y * 13) % 26);
+				break;
+		}
+	}
+
+	out[0] = chr;
+	out[1] = color;
+}
+
+// Fills in the tile and stat arrays; returns false if the data is malformed.
+static bool parse_board(const world_format *fmt, thumbnail_state *t, const u8 *data, size_t len) {
+	int tile_count = fmt->board_width * fmt->board_height;
+	size_t pos = 1 + fmt->board_name_size;
+
+	// RLE tiles: count (0 = 256), element, color
+	for (int i = 0; i < tile_count;) {
+		if (pos + 3 > len) return false;
+		int count = data[pos] == 0 ? 256 : data[pos];
+		for (int j = 0; j < count && i < tile_count; j++, i++) {
+			t->tiles[i].element = data[pos + 1];
+			t->tiles[i].color = data[pos + 2];
+			t->tiles[i].stat = -1;
+		}
+		pos += 3;
+	}
+
+	pos += fmt->board_info_size;
+	if (pos + 2 > len) return false;
+	int stat_count = ((s16) get16(data + pos)) + 1;
+	pos += 2;
+	if (stat_count < 0 || stat_count > tile_count + 1) return false;
+
+	for (int i = 0; i < stat_count; i++) {
+		if (pos + fmt->stat_size > len) return false;
+		const u8 *s = data + pos;
+		int x = s[0] - 1;
+		int y = s[1] - 1;
+		s16 code_length = get16(s + 23);
+
+		t->stats[i].step_x = get16(s + 2);
+		t->stats[i].step_y = get16(s + 4);
+		t->stats[i].p1 = s[8];
+		if (x >= 0 && y >= 0 && x < fmt->board_width && y < fmt->board_height) {
+			t->tiles[y * fmt->board_width + x].stat = i;
+		}
+
+		pos += fmt->stat_size;
+		if (code_length > 0) pos += code_length;
+	}
+
+	return true;
+}
+
+static void render_world(thumbnail_state *t, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "%s: could not open\n", path);
+		t->errors++;
+		return;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	u8 *data = len > 0 ? malloc(len) : NULL;
+	if (data == NULL || fread(data, len, 1, file) != 1) {
+		fprintf(stderr, "%s: could not read\n", path);
+		free(data);
+		fclose(file);
+		t->errors++;
+		return;
+	}
+	fclose(file);
+
+	const world_format *fmt = NULL;
+	if (len >= 4) {
+		s16 magic = get16(data);
+		if (magic == -1) fmt = &format_zzt;
+		else if (magic == -2) fmt = &format_szt;
+	}
+	if (fmt == NULL || len < fmt->header_size) {
+		fprintf(stderr, "%s: not a ZZT or Super ZZT world\n", path);
+		free(data);
+		t->errors++;
+		return;
+	}
+
+	const char *name = strrchr(path, '/');
+	name = name != NULL ? name + 1 : path;
+
+	int board_count = ((s16) get16(data + 2)) + 1;
+	long pos = fmt->header_size;
+	int width = fmt->board_width * CHAR_WIDTH;
+	int height = fmt->board_height * CHAR_HEIGHT;
+
+	for (int b = 0; b < board_count; b++) {
+		if (pos + 2 > len) break;
+		int board_len = get16(data + pos);
+		pos += 2;
+		if (pos + board_len > len) board_len = len - pos;
+
+		if (!parse_board(fmt, t, data + pos, board_len)) {
+			fprintf(stderr, "%s: board %d is malformed\n", path, b);
+			t->errors++;
+		} else {
+			for (int y = 0; y < fmt->board_height; y++) {
+				for (int x = 0; x < fmt->board_width; x++) {
+					draw_tile(fmt, t, x, y, t->video + ((y * fmt->board_width + x) * 2));
+				}
+			}
+			render_software_paletted(t->pixels, fmt->board_width, fmt->board_height, -1, RENDER_BLINK_OFF,
+				t->video, res_8x14_bin, CHAR_WIDTH, CHAR_HEIGHT);
+
+			char filename[FILENAME_MAX];
+			snprintf(filename, sizeof(filename), "%s/%s.%03d.png", t->output_dir, name, b);
+			FILE *output = fopen(filename, "wb");
+			if (output == NULL || png_writer_write(t->png, output, t->pixels, width, height, t->palette) < 0) {
+				fprintf(stderr, "%s: could not write %s\n", path, filename);
+				t->errors++;
+			} else {
+				t->boards_written++;
+			}
+			if (output != NULL) fclose(output);
+		}
+
+		pos += board_len;
+	}
+
+	free(data);
+}
+
+static bool thumbnail_init(thumbnail_state *t, const char *output_dir) {
+	static const u8 ega_palette_lut[16] = {0, 1, 2, 3, 4, 5, 20, 7, 56, 57, 58, 59, 60, 61, 62, 63};
+	int max_tiles = format_szt.board_width * format_szt.board_height;
+
+	memset(t, 0, sizeof(thumbnail_state));
+	t->output_dir = output_dir;
+	for (int i = 0; i < 16; i++) {
+		int c = ega_palette_lut[i];
+		t->palette[i] = 0xFF000000
+			| ((((c >> 2) & 1) * 0xAA + ((c >> 5) & 1) * 0x55) << 16)
+			| ((((c >> 1) & 1) * 0xAA + ((c >> 4) & 1) * 0x55) << 8)
+			| ((c & 1) * 0xAA + ((c >> 3) & 1) * 0x55);
+	}
+
+	t->png = png_writer_create();
+	t->tiles = malloc(sizeof(board_tile) * max_tiles);
+	t->stats = malloc(sizeof(board_stat) * (max_tiles + 1));
+	t->video = malloc(max_tiles * 2);
+	t->pixels = malloc(max_tiles * CHAR_WIDTH * CHAR_HEIGHT);
+	return t->png != NULL && t->tiles != NULL && t->stats != NULL && t->video != NULL && t->pixels != NULL;
+}
+
+static void thumbnail_free(thumbnail_state *t) {
+	if (t->png != NULL) png_writer_free(t->png);
+	free(t->tiles);
+	free(t->stats);
+	free(t->video);
+	free(t->pixels);
+}
+
+// work queue shared by all threads
+
+static char **world_paths;
+static int world_count;
+static int world_next;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t world_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void add_world(const char *path) {
+	if ((world_count & 255) == 0) {
+		world_paths = realloc(world_paths, sizeof(char*) * (world_count + 256));
+	}
+	world_paths[world_count++] = strdup(path);
+}
+
+static bool is_world_filename(const char *name) {
+	const char *ext = strrchr(name, '.');
+	return ext != NULL && (!strcasecmp(ext, ".zzt") || !strcasecmp(ext, ".szt"));
+}
+
+static void add_path(const char *path) {
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		add_world(path);
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (is_world_filename(entry->d_name)) {
+			char filename[FILENAME_MAX];
+			snprintf(filename, sizeof(filename), "%s/%s", path, entry->d_name);
+			add_world(filename);
+		}
+	}
+	closedir(dir);
+}
+
+static const char *next_world(void) {
+	const char *path = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&world_lock);
+#endif
+	if (world_next < world_count) {
+		path = world_paths[world_next++];
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&world_lock);
+#endif
+	return path;
+}
+
+static void *thumbnail_thread(void *arg) {
+	thumbnail_state *t = (thumbnail_state*) arg;
+	const char *path;
+
+	while ((path = next_world()) != NULL) {
+		render_world(t, path);
+	}
+	return NULL;
+}
+
+static void thumbnail_help(const char *name) {
+	fprintf(stderr, "Usage: %s [arguments] <world files or directories...>\n", name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Writes every board as [output directory]/[world file name].[board number].png.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Arguments:\n");
+#ifdef HAVE_PTHREAD
+	fprintf(stderr, "  -j []  number of worlds processed in parallel (default: CPU count)\n");
+#endif
+	fprintf(stderr, "  -o []  output directory (default: current directory)\n");
+}
+
+int main(int argc, char **argv) {
+	thumbnail_state states[MAX_JOBS];
+	const char *output_dir = ".";
+	int jobs = 1;
+	int c;
+
+#ifdef HAVE_PTHREAD
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	while ((c = getopt(argc, argv, "j:o:h")) >= 0) {
+		switch (c) {
+			case 'j': jobs = atoi(optarg); break;
+			case 'o': output_dir = optarg; break;
+			default:
+				thumbnail_help(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		thumbnail_help(argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; i++) {
+		add_path(argv[i]);
+	}
+	if (jobs > world_count) jobs = world_count;
+	if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+	if (jobs < 1) jobs = 1;
+
+	int result = 0;
+	int started = 0;
+	for (; started < jobs; started++) {
+		if (!thumbnail_init(&states[started], output_dir)) {
+			thumbnail_free(&states[started]);
+			break;
+		}
+	}
+	if (started == 0) {
+		fprintf(stderr, "Out of memory!\n");
+		return 1;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_t threads[MAX_JOBS];
+	bool threaded[MAX_JOBS];
+	for (int i = 1; i < started; i++) {
+		threaded[i] = pthread_create(&threads[i], NULL, thumbnail_thread, &states[i]) == 0;
+	}
+#endif
+	thumbnail_thread(&states[0]);
+
+	int boards_written = 0;
+	for (int i = 0; i < started; i++) {
+#ifdef HAVE_PTHREAD
+		if (i > 0 && threaded[i]) {
+			pthread_join(threads[i], NULL);
+		}
+#endif
+		boards_written += states[i].boards_written;
+		if (states[i].errors > 0) result = 1;
+		thumbnail_free(&states[i]);
+	}
+
+	fprintf(stderr, "%d worlds, %d boards written.\n", world_count, boards_written);
+
+	for (int i = 0; i < world_count; i++) {
+		free(world_paths[i]);
+	}
+	free(world_paths);
+	return result;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __TRACE_FORMAT_H__
+#define __TRACE_FORMAT_H__
+
+#include "config.h"
+
+// Session trace format: the "ZTRC" magic and a version byte, followed by a
+// stream of records, each starting with an opcode byte. Numbers are LEB128
+// varints unless noted otherwise; "svarint" denotes a zigzag-encoded one.
+// The whole stream is gzip-compressed when zlib is available.
+
+#define TRACE_MAGIC "ZTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_OP_END 0x00
+// varint: elapsed emulated time, in microseconds
+#define TRACE_OP_TICK 0x01
+// varint: run count; per run: varint cells skipped since the previous run,
+// varint run length in cells, then (length * 2) bytes of character/attribute
+#define TRACE_OP_VRAM 0x02
+// varint: width, height (in characters)
+#define TRACE_OP_SCREEN 0x03
+// varint: width, height; then (256 * height) bytes of glyph data
+#define TRACE_OP_CHARSET 0x04
+// 16 * 3 bytes: R, G, B
+#define TRACE_OP_PALETTE 0x05
+// u8: blink enabled; svarint: active blink duration, in milliseconds
+#define TRACE_OP_BLINK 0x06
+// svarint: time since the previous speaker event, in microseconds;
+// varint: cycles; 8 bytes: frequency (little-endian IEEE 754 double)
+#define TRACE_OP_SPEAKER_ON 0x07
+// svarint: time since the previous speaker event, in microseconds;
+// varint: cycles
+#define TRACE_OP_SPEAKER_OFF 0x08
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+typedef gzFile trace_file;
+#define trace_file_open(name, mode) gzopen((name), (mode))
+#define trace_file_read(f, ptr, len) gzread((f), (ptr), (len))
+#define trace_file_write(f, ptr, len) gzwrite((f), (ptr), (len))
+#define trace_file_close(f) gzclose(f)
+#else
+#include <stdio.h>
+typedef FILE* trace_file;
+#define trace_file_open(name, mode) fopen((name), (mode))
+#define trace_file_read(f, ptr, len) ((int) fread((ptr), 1, (len), (f)))
+#define trace_file_write(f, ptr, len) ((int) fwrite((ptr), 1, (len), (f)))
+#define trace_file_close(f) fclose(f)
+#endif
+
+#endif /* __TRACE_FORMAT_H__ */
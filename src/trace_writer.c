@@ -0,0 +1,314 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "zzt.h"
+#include "trace_format.h"
+#include "trace_writer.h"
+
+// Unchanged cells between two runs cost less than starting a new run.
+#define TRACE_MAX_GAP_FILL 2
+
+typedef struct s_trace_writer_state {
+	trace_file file;
+
+	u8 *buffer;
+	size_t buffer_len;
+	size_t buffer_size;
+	bool failed; // out of memory; records are dropped until stopped
+
+	int screen_width;
+	int screen_height;
+	int char_width;
+	int char_height;
+	bool blink;
+	int blink_duration;
+	bool charset_changed;
+	bool palette_changed;
+	u8 shadow_vram[80 * 50 * 2];
+	zzt_vram_dirty vram_dirty;
+
+	double time_origin;
+	double tick_fraction; // in microseconds
+	s64 last_event_us;
+} trace_writer_state;
+
+static bool trace_reserve(trace_writer_state *s, size_t len) {
+	if (s->failed) return false;
+	if (s->buffer_len + len > s->buffer_size) {
+		size_t buffer_size = s->buffer_size;
+		while (s->buffer_len + len > buffer_size) {
+			buffer_size *= 2;
+		}
+		u8 *buffer = realloc(s->buffer, buffer_size);
+		if (buffer == NULL) {
+			s->failed = true;
+			return false;
+		}
+		s->buffer = buffer;
+		s->buffer_size = buffer_size;
+	}
+	return true;
+}
+
+static void trace_put8(trace_writer_state *s, u8 v) {
+	if (!trace_reserve(s, 1)) return;
+	s->buffer[s->buffer_len++] = v;
+}
+
+static void trace_put_bytes(trace_writer_state *s, const u8 *data, size_t len) {
+	if (!trace_reserve(s, len)) return;
+	memcpy(s->buffer + s->buffer_len, data, len);
+	s->buffer_len += len;
+}
+
+static void trace_put_varint(trace_writer_state *s, u64 v) {
+	while (v >= 0x80) {
+		trace_put8(s, (v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	trace_put8(s, v);
+}
+
+static void trace_put_svarint(trace_writer_state *s, s64 v) {
+	trace_put_varint(s, v < 0 ? ((((u64) -(v + 1)) << 1) | 1) : (((u64) v) << 1));
+}
+
+static void trace_flush(trace_writer_state *s) {
+	if (s->buffer_len > 0) {
+		trace_file_write(s->file, s->buffer, s->buffer_len);
+		s->buffer_len = 0;
+	}
+}
+
+trace_writer_state *trace_writer_start(const char *filename, double time) {
+	trace_file file = trace_file_open(filename, "wb");
+	if (file == NULL) return NULL;
+
+	trace_writer_state *s = malloc(sizeof(trace_writer_state));
+	if (s == NULL) {
+		trace_file_close(file);
+		return NULL;
+	}
+	memset(s, 0, sizeof(trace_writer_state));
+
+	s->file = file;
+	s->buffer_size = 16384;
+	s->buffer = malloc(s->buffer_size);
+	if (s->buffer == NULL) {
+		trace_file_close(file);
+		free(s);
+		return NULL;
+	}
+	s->time_origin = time;
+	s->blink_duration = -2; // forces the initial blink record
+	s->charset_changed = true;
+	s->palette_changed = true;
+
+	trace_put_bytes(s, (const u8*) TRACE_MAGIC, 4);
+	trace_put8(s, TRACE_VERSION);
+	trace_flush(s);
+
+	zzt_register_vram_dirty(&s->vram_dirty);
+	return s;
+}
+
+void trace_writer_stop(trace_writer_state *s) {
+	zzt_unregister_vram_dirty(&s->vram_dirty);
+	if (s->failed) {
+		// the failed frame was never flushed; end the trace after the last good one
+		s->failed = false;
+		s->buffer_len = 0;
+	}
+	trace_put8(s, TRACE_OP_END);
+	trace_flush(s);
+	trace_file_close(s->file);
+	free(s->buffer);
+	free(s);
+}
+
+// only cells written since the last frame are compared with the shadow copy
+static inline bool trace_cell_changed(trace_writer_state *s, u8 *vram, int i) {
+	return (s->vram_dirty.cells[i >> 3] & (1 << (i & 7)))
+		&& memcmp(vram + i * 2, s->shadow_vram + i * 2, 2);
+}
+
+static void trace_write_vram(trace_writer_state *s, u8 *vram, bool full) {
+	int cells = s->screen_width * s->screen_height;
+	int run_count = 0;
+	size_t count_pos;
+	int last_end = 0;
+
+	if (!full && !s->vram_dirty.any) {
+		return;
+	}
+
+	// the run count is patched in afterwards; reserve the worst case
+	trace_put8(s, TRACE_OP_VRAM);
+	count_pos = s->buffer_len;
+	trace_put_bytes(s, (const u8*) "\x80\x80\x00", 3);
+
+	int i = 0;
+	while (i < cells) {
+		if (!full && !trace_cell_changed(s, vram, i)) {
+			i++;
+			continue;
+		}
+
+		int start = i;
+		int end = i + 1;
+		while (end < cells) {
+			int gap = 0;
+			while ((end + gap) < cells && gap <= TRACE_MAX_GAP_FILL
+				&& !full && !trace_cell_changed(s, vram, end + gap))
+			{
+				gap++;
+			}
+			if ((end + gap) >= cells || gap > TRACE_MAX_GAP_FILL) break;
+			end += gap + 1;
+		}
+
+		trace_put_varint(s, start - last_end);
+		trace_put_varint(s, end - start);
+		trace_put_bytes(s, vram + start * 2, (end - start) * 2);
+		run_count++;
+		last_end = end;
+		i = end;
+	}
+
+	if (s->failed) {
+		return;
+	}
+
+	if (run_count == 0) {
+		s->buffer_len = count_pos - 1;
+		return;
+	}
+
+	// fixed-width varint, so the offsets above stay valid
+	s->buffer[count_pos] = (run_count & 0x7F) | 0x80;
+	s->buffer[count_pos + 1] = ((run_count >> 7) & 0x7F) | 0x80;
+	s->buffer[count_pos + 2] = (run_count >> 14) & 0x7F;
+	memcpy(s->shadow_vram, vram, cells * 2);
+}
+
+int trace_writer_frame(trace_writer_state *s, double elapsed_ms) {
+	int screen_width, screen_height, char_width, char_height;
+	bool full_vram = false;
+
+	zzt_get_screen_size(&screen_width, &screen_height);
+	u8 *charset = zzt_get_charset(&char_width, &char_height);
+
+	if (screen_width != s->screen_width || screen_height != s->screen_height) {
+		s->screen_width = screen_width;
+		s->screen_height = screen_height;
+		trace_put8(s, TRACE_OP_SCREEN);
+		trace_put_varint(s, screen_width);
+		trace_put_varint(s, screen_height);
+		full_vram = true;
+	}
+
+	if (s->charset_changed || char_width != s->char_width || char_height != s->char_height) {
+		s->char_width = char_width;
+		s->char_height = char_height;
+		trace_put8(s, TRACE_OP_CHARSET);
+		trace_put_varint(s, char_width);
+		trace_put_varint(s, char_height);
+		trace_put_bytes(s, charset, 256 * char_height);
+		s->charset_changed = false;
+	}
+
+	if (s->palette_changed) {
+		u32 *palette = zzt_get_palette();
+		trace_put8(s, TRACE_OP_PALETTE);
+		for (int i = 0; i < 16; i++) {
+			trace_put8(s, palette[i] >> 16);
+			trace_put8(s, palette[i] >> 8);
+			trace_put8(s, palette[i]);
+		}
+		s->palette_changed = false;
+	}
+
+	bool blink = zzt_get_blink() != 0;
+	int blink_duration = zzt_get_active_blink_duration_ms();
+	if (blink != s->blink || blink_duration != s->blink_duration) {
+		s->blink = blink;
+		s->blink_duration = blink_duration;
+		trace_put8(s, TRACE_OP_BLINK);
+		trace_put8(s, blink ? 1 : 0);
+		trace_put_svarint(s, blink_duration);
+	}
+
+	zzt_update_vram_dirty();
+	trace_write_vram(s, zzt_get_ram() + 0xB8000, full_vram);
+	if (!s->failed) {
+		zzt_clear_vram_dirty(&s->vram_dirty);
+	}
+
+	// carry the sub-microsecond remainder over to the next tick
+	double elapsed_us = elapsed_ms * 1000.0 + s->tick_fraction;
+	u32 tick_us = (u32) elapsed_us;
+	s->tick_fraction = elapsed_us - tick_us;
+	trace_put8(s, TRACE_OP_TICK);
+	trace_put_varint(s, tick_us);
+
+	if (s->failed) {
+		return -1;
+	}
+	trace_flush(s);
+	return 0;
+}
+
+static void trace_put_event_time(trace_writer_state *s, double time) {
+	s64 time_us = (s64) ((time - s->time_origin) * 1000.0);
+	trace_put_svarint(s, time_us - s->last_event_us);
+	s->last_event_us = time_us;
+}
+
+void trace_writer_speaker_on(trace_writer_state *s, double time, int cycles, double freq) {
+	u64 freq_bits;
+	memcpy(&freq_bits, &freq, sizeof(double));
+
+	trace_put8(s, TRACE_OP_SPEAKER_ON);
+	trace_put_event_time(s, time);
+	trace_put_varint(s, cycles);
+	for (int i = 0; i < 8; i++, freq_bits >>= 8) {
+		trace_put8(s, freq_bits & 0xFF);
+	}
+}
+
+void trace_writer_speaker_off(trace_writer_state *s, double time, int cycles) {
+	trace_put8(s, TRACE_OP_SPEAKER_OFF);
+	trace_put_event_time(s, time);
+	trace_put_varint(s, cycles);
+}
+
+void trace_writer_on_charset_change(trace_writer_state *s) {
+	s->charset_changed = true;
+}
+
+void trace_writer_on_palette_change(trace_writer_state *s) {
+	s->palette_changed = true;
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __TRACE_WRITER_H__
+#define __TRACE_WRITER_H__
+
+#include "types.h"
+
+typedef struct s_trace_writer_state trace_writer_state;
+
+trace_writer_state *trace_writer_start(const char *filename, double time);
+void trace_writer_stop(trace_writer_state *s);
+// Returns a negative value if the frame could not be recorded; the writer
+// should then be stopped.
+int trace_writer_frame(trace_writer_state *s, double elapsed_ms);
+void trace_writer_speaker_on(trace_writer_state *s, double time, int cycles, double freq);
+void trace_writer_speaker_off(trace_writer_state *s, double time, int cycles);
+void trace_writer_on_charset_change(trace_writer_state *s);
+void trace_writer_on_palette_change(trace_writer_state *s);
+
+#endif
@@ -72,6 +72,13 @@ static const char* ui_lines_options[] = {
 };
 #define UI_LINES_OPTIONS_COUNT 5
 
+// audio pipeline statistics, refreshed every tick
+#ifdef __EMSCRIPTEN__
+#define UI_LINES_STATS_COUNT 0
+#else
+#define UI_LINES_STATS_COUNT 6
+#endif
+
 void ui_activate(void) {
     if (ui_is_active()) return;
 
@@ -95,6 +102,7 @@ static void ui_deactivate(void) {
     if (!ui_is_active()) return;
 
     memcpy(zzt_get_ram() + 0xB8000, ui_state->screen_backup, 80 * 50 * 2);
+    zzt_mark_vram_dirty(0, 80 * 50 * 2);
 #ifndef AVOID_MALLOC
     free(ui_state);
 #endif
@@ -112,6 +120,7 @@ static void ui_draw_char(int x, int y, uint8_t chr, uint8_t col) {
     uint8_t *vid_mem = zzt_get_ram() + 0xB8000;
     vid_mem[y * x_mul + x * 2] = chr;
     vid_mem[y * x_mul + x * 2 + 1] = col;
+    zzt_mark_vram_dirty(y * x_mul + x * 2, 2);
 }
 
 static void ui_darken_char(int x, int y) {
@@ -119,6 +128,7 @@ static void ui_darken_char(int x, int y) {
 
     int x_mul = (zzt_video_mode() & 2) ? 160 : 80;
     uint8_t *vid_mem = zzt_get_ram() + 0xB8000 + y * x_mul + x * 2 + 1;
+    zzt_mark_vram_dirty(y * x_mul + x * 2, 2);
     uint8_t col = (*vid_mem) & 0x0F;
     if (col >= 0x9) {
         col -= 0x8;
@@ -136,6 +146,15 @@ static void ui_draw_string(int x, int y, const char *s, uint8_t col) {
     }
 }
 
+#if UI_LINES_STATS_COUNT > 0
+// draws exactly [width] characters, padding with blanks
+static void ui_draw_string_fixed(int x, int y, const char *s, int width, uint8_t col) {
+    for (int i = 0; i < width; i++) {
+        ui_draw_char(x + i, y, *s != '\0' ? *(s++) : ' ', col);
+    }
+}
+#endif
+
 static void ui_draw_check_char(int x, int y, const char *s, uint8_t value, uint8_t col) {
     ui_draw_char(x + strlen(s) - 2, y, value, col);
 }
@@ -162,6 +181,9 @@ void ui_tick(void) {
     char sbuf[37];
 
     int wwidth = 36, wheight = 1 + UI_LINES_HEADER_COUNT + UI_LINES_OPTIONS_COUNT + 3;
+    if (UI_LINES_STATS_COUNT > 0) {
+        wheight += UI_LINES_STATS_COUNT + 1;
+    }
     int swidth, sheight;
     zzt_get_screen_size(&swidth, &sheight);
     int wx = (swidth - wwidth) >> 1;
@@ -241,6 +263,48 @@ void ui_tick(void) {
 
         // draw arrow
         ui_draw_char(woptx, wopty + ui_state->option_y, 16, 0x1D);
+
+#if UI_LINES_STATS_COUNT > 0
+        // draw audio statistics
+        {
+            audio_stream_stats stats;
+            audio_wavetable_stats wt_stats;
+            int wstaty = wopty + UI_LINES_OPTIONS_COUNT + 1;
+            u64 callbacks;
+
+            audio_stream_get_stats(&stats);
+            audio_wavetable_get_stats(&wt_stats);
+            callbacks = stats.callbacks > 0 ? stats.callbacks : 1;
+
+            snprintf(sbuf, sizeof(sbuf) - 1, "  Callback: %.2f ms, max %.2f",
+                stats.callback_us_total / (double) callbacks / 1000.0,
+                stats.callback_us_max / 1000.0);
+            ui_draw_string_fixed(woptx, wstaty, sbuf, wwidth - 4, 0x17);
+            snprintf(sbuf, sizeof(sbuf) - 1, "  Entries: %.1f, max %llu",
+                stats.entries / (double) callbacks,
+                stats.entries_max);
+            ui_draw_string_fixed(woptx, wstaty + 1, sbuf, wwidth - 4, 0x17);
+            snprintf(sbuf, sizeof(sbuf) - 1, "  Drift: %+.1f ms, jitter %.1f",
+                stats.drift_us / 1000.0,
+                stats.jitter_us / 1000.0);
+            ui_draw_string_fixed(woptx, wstaty + 2, sbuf, wwidth - 4, 0x17);
+            snprintf(sbuf, sizeof(sbuf) - 1, "  Rate: %+lld ppm, resyncs %llu",
+                stats.ratio_ppm,
+                stats.resyncs);
+            ui_draw_string_fixed(woptx, wstaty + 3, sbuf, wwidth - 4, 0x17);
+            snprintf(sbuf, sizeof(sbuf) - 1, "  Overruns: %llu, dropped %llu",
+                stats.overruns,
+                stats.entries_dropped);
+            ui_draw_string_fixed(woptx, wstaty + 4, sbuf, wwidth - 4, 0x17);
+            if (wt_stats.lookups > 0) {
+                snprintf(sbuf, sizeof(sbuf) - 1, "  Wavetable hits: %llu%%",
+                    wt_stats.hits * 100 / wt_stats.lookups);
+            } else {
+                snprintf(sbuf, sizeof(sbuf) - 1, "  Wavetable hits: -");
+            }
+            ui_draw_string_fixed(woptx, wstaty + 5, sbuf, wwidth - 4, 0x17);
+        }
+#endif
     }
 
     zzt_key_t key = zzt_key_pop();
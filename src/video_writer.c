@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "zzt.h"
+#include "video_writer.h"
+#include "render_software.h"
+
+// Default PIT rate, as a fraction.
+#define VIDEO_PIT_RATE_NUM 1193182
+#define VIDEO_PIT_RATE_DEN 65536
+
+typedef struct s_video_writer_state {
+	FILE *file;
+	int format;
+	int fps;
+
+	// output canvas size, fixed for the whole stream
+	int width;
+	int height;
+
+	double time_ms;
+	double next_frame_ms;
+
+	u8 *index_buffer;
+	size_t index_buffer_size;
+	u8 *out_buffer;
+	u8 colors[16][3];
+} video_writer_state;
+
+video_writer_state *video_writer_start(const char *filename, int format, int fps) {
+	int scr_width, scr_height, char_width, char_height;
+	FILE *file;
+
+	if (!strcmp(filename, "-")) {
+		file = stdout;
+	} else {
+		file = fopen(filename, "wb");
+		if (file == NULL) return NULL;
+	}
+
+	video_writer_state *s = malloc(sizeof(video_writer_state));
+	if (s == NULL) {
+		if (file != stdout) fclose(file);
+		return NULL;
+	}
+	memset(s, 0, sizeof(video_writer_state));
+
+	zzt_get_screen_size(&scr_width, &scr_height);
+	zzt_get_charset(&char_width, &char_height);
+
+	s->file = file;
+	s->format = format;
+	s->fps = fps;
+	s->width = scr_width * char_width * (scr_width <= 40 ? 2 : 1);
+	s->height = scr_height * char_height;
+	s->out_buffer = malloc(s->width * s->height * 3);
+	if (s->out_buffer == NULL) {
+		if (file != stdout) fclose(file);
+		free(s);
+		return NULL;
+	}
+
+	if (format == VIDEO_WRITER_FORMAT_Y4M) {
+		if (fps > 0) {
+			fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", s->width, s->height, fps);
+		} else {
+			fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n", s->width, s->height, VIDEO_PIT_RATE_NUM, VIDEO_PIT_RATE_DEN);
+		}
+	}
+
+	return s;
+}
+
+void video_writer_stop(video_writer_state *s) {
+	if (s->file == stdout) {
+		fflush(s->file);
+	} else {
+		fclose(s->file);
+	}
+	free(s->out_buffer);
+	if (s->index_buffer != NULL) free(s->index_buffer);
+	free(s);
+}
+
+static void video_update_colors(video_writer_state *s) {
+	u32 *palette = zzt_get_palette();
+
+	for (int i = 0; i < 16; i++) {
+		int r = (palette[i] >> 16) & 0xFF;
+		int g = (palette[i] >> 8) & 0xFF;
+		int b = palette[i] & 0xFF;
+
+		if (s->format == VIDEO_WRITER_FORMAT_Y4M) {
+			// BT.601, limited range
+			s->colors[i][0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+			s->colors[i][1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+			s->colors[i][2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+		} else {
+			s->colors[i][0] = r;
+			s->colors[i][1] = g;
+			s->colors[i][2] = b;
+		}
+	}
+}
+
+static int video_render_frame(video_writer_state *s) {
+	int scr_width, scr_height, char_width, char_height;
+	int flags = 0;
+
+	zzt_get_screen_size(&scr_width, &scr_height);
+	u8 *charset = zzt_get_charset(&char_width, &char_height);
+
+	if (!zzt_get_blink()) {
+		flags |= RENDER_BLINK_OFF;
+	} else {
+		int blink_ms = zzt_get_active_blink_duration_ms();
+		if (blink_ms > 0 && (((long) (s->time_ms / blink_ms)) & 1)) {
+			flags |= RENDER_BLINK_PHASE;
+		}
+	}
+
+	int src_width = scr_width * char_width;
+	int src_height = scr_height * char_height;
+	if (s->index_buffer_size < (size_t) (src_width * src_height)) {
+		if (s->index_buffer != NULL) free(s->index_buffer);
+		s->index_buffer_size = src_width * src_height;
+		s->index_buffer = malloc(s->index_buffer_size);
+		if (s->index_buffer == NULL) {
+			s->index_buffer_size = 0;
+			return -1;
+		}
+	}
+
+	render_software_paletted(s->index_buffer, scr_width, scr_height, -1, flags, zzt_get_ram() + 0xB8000, charset, char_width, char_height);
+	video_update_colors(s);
+
+	// the canvas size is fixed, so crop or pad if the video mode changed since
+	int x_shift = scr_width <= 40 ? 1 : 0;
+	int plane_size = s->width * s->height;
+	u8 *out = s->out_buffer;
+
+	for (int y = 0; y < s->height; y++) {
+		u8 *src = s->index_buffer + (y * src_width);
+		for (int x = 0; x < s->width; x++, out += (s->format == VIDEO_WRITER_FORMAT_Y4M ? 1 : 3)) {
+			int sx = x >> x_shift;
+			u8 *color = s->colors[(y < src_height && sx < src_width) ? src[sx] : 0];
+			if (s->format == VIDEO_WRITER_FORMAT_Y4M) {
+				out[0] = color[0];
+				out[plane_size] = color[1];
+				out[plane_size * 2] = color[2];
+			} else {
+				out[0] = color[0];
+				out[1] = color[1];
+				out[2] = color[2];
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int video_write_frame(video_writer_state *s) {
+	if (s->format == VIDEO_WRITER_FORMAT_Y4M) {
+		fwrite("FRAME\n", 6, 1, s->file);
+	}
+	if (fwrite(s->out_buffer, s->width * s->height * 3, 1, s->file) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+int video_writer_frame(video_writer_state *s, double elapsed_ms) {
+	int result = 0;
+
+	if (s->fps <= 0) {
+		if (video_render_frame(s) < 0) return -1;
+		result = video_write_frame(s);
+	} else if (s->time_ms >= s->next_frame_ms) {
+		// the screen is only rendered once, even if several frames are due
+		if (video_render_frame(s) < 0) return -1;
+		while (result >= 0 && s->time_ms >= s->next_frame_ms) {
+			result = video_write_frame(s);
+			s->next_frame_ms += 1000.0 / s->fps;
+		}
+	}
+
+	s->time_ms += elapsed_ms;
+	return result;
+}
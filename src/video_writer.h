@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __VIDEO_WRITER_H__
+#define __VIDEO_WRITER_H__
+
+#include "types.h"
+
+#define VIDEO_WRITER_FORMAT_Y4M 0
+#define VIDEO_WRITER_FORMAT_RGB 1
+
+typedef struct s_video_writer_state video_writer_state;
+
+// filename may be "-" for standard output. If fps is 0, one frame is written
+// per video_writer_frame() call (the PIT rate, when called once per tick);
+// otherwise, frames are resampled to the given rate using the elapsed time.
+video_writer_state *video_writer_start(const char *filename, int format, int fps);
+void video_writer_stop(video_writer_state *s);
+int video_writer_frame(video_writer_state *s, double elapsed_ms);
+
+#endif
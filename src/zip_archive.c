@@ -0,0 +1,403 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "config.h"
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "zip_archive.h"
+
+#define ZIP_EOCD_SIGNATURE 0x06054B50
+#define ZIP_CDIR_SIGNATURE 0x02014B50
+#define ZIP_LOCAL_SIGNATURE 0x04034B50
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CDIR_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_MAX_COMMENT_SIZE 65535
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+#define ZIP_FLAG_ENCRYPTED 0x0001
+
+typedef struct {
+	u32 name_offset;
+	u32 local_offset;
+	u32 compressed_size;
+	u32 size;
+	u32 crc32;
+	u16 method;
+	u16 flags;
+	bool is_dir;
+	u8 *cache; // decompressed data, if any
+} zip_entry;
+
+struct s_zip_archive {
+	const u8 *data;
+	size_t data_len;
+	bool mapped;
+
+	int count;
+	zip_entry *entries;
+	char *names;
+
+	// case-insensitive name lookup; entry index + 1, 0 = empty slot
+	int table_mask;
+	int *table;
+};
+
+static inline u16 zip_read16(const u8 *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline u32 zip_read32(const u8 *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32) p[3] << 24);
+}
+
+static u32 zip_hash_name(const char *name) {
+	u32 hash = 2166136261U;
+	while (*name != '\0') {
+		char c = *(name++);
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		hash = (hash ^ (u8) c) * 16777619U;
+	}
+	return hash;
+}
+
+static int zip_archive_load(zip_archive *z, const char *filename) {
+#ifdef HAVE_MMAP
+	struct stat st;
+	void *ptr;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "zip: could not open %s\n", filename);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		fprintf(stderr, "zip: could not read %s\n", filename);
+		close(fd);
+		return -1;
+	}
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "zip: could not map %s\n", filename);
+		return -1;
+	}
+	z->data = ptr;
+	z->data_len = st.st_size;
+	z->mapped = true;
+	return 0;
+#else
+	long size;
+	u8 *buffer;
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "zip: could not open %s\n", filename);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size <= 0 || (buffer = malloc(size)) == NULL) {
+		fprintf(stderr, "zip: could not read %s\n", filename);
+		fclose(file);
+		return -1;
+	}
+	if (fread(buffer, size, 1, file) != 1) {
+		fprintf(stderr, "zip: could not read %s\n", filename);
+		free(buffer);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	z->data = buffer;
+	z->data_len = size;
+	z->mapped = false;
+	return 0;
+#endif
+}
+
+static int zip_archive_parse(zip_archive *z) {
+	const u8 *eocd = NULL;
+	size_t pos, min_pos, cdir_pos, cdir_end;
+	size_t names_len = 0;
+
+	if (z->data_len < ZIP_EOCD_SIZE) {
+		fprintf(stderr, "zip: file too small\n");
+		return -1;
+	}
+
+	// the end of central directory record sits before an optional comment
+	min_pos = z->data_len > (ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE) ? (z->data_len - ZIP_EOCD_SIZE - ZIP_MAX_COMMENT_SIZE) : 0;
+	for (pos = z->data_len - ZIP_EOCD_SIZE; ; pos--) {
+		if (zip_read32(z->data + pos) == ZIP_EOCD_SIGNATURE) {
+			eocd = z->data + pos;
+			break;
+		}
+		if (pos == min_pos) break;
+	}
+	if (eocd == NULL) {
+		fprintf(stderr, "zip: end of central directory not found\n");
+		return -1;
+	}
+
+	z->count = zip_read16(eocd + 10);
+	cdir_pos = zip_read32(eocd + 16);
+	cdir_end = cdir_pos + zip_read32(eocd + 12);
+	if (z->count == 0xFFFF || zip_read32(eocd + 16) == 0xFFFFFFFF) {
+		fprintf(stderr, "zip: ZIP64 archives are not supported\n");
+		return -1;
+	}
+	if (cdir_end > pos || cdir_pos > cdir_end) {
+		fprintf(stderr, "zip: invalid central directory\n");
+		return -1;
+	}
+
+	z->entries = calloc(z->count > 0 ? z->count : 1, sizeof(zip_entry));
+	// every record is larger than its name plus terminator
+	z->names = malloc(cdir_end - cdir_pos + 1);
+	if (z->entries == NULL || z->names == NULL) {
+		return -1;
+	}
+
+	for (int i = 0; i < z->count; i++) {
+		const u8 *rec = z->data + cdir_pos;
+		zip_entry *e = &z->entries[i];
+		u16 name_len;
+		char *name;
+
+		if (cdir_pos + ZIP_CDIR_SIZE > cdir_end || zip_read32(rec) != ZIP_CDIR_SIGNATURE) {
+			fprintf(stderr, "zip: invalid central directory\n");
+			return -1;
+		}
+		name_len = zip_read16(rec + 28);
+		if (cdir_pos + ZIP_CDIR_SIZE + name_len > cdir_end) {
+			fprintf(stderr, "zip: invalid central directory\n");
+			return -1;
+		}
+
+		e->flags = zip_read16(rec + 8);
+		e->method = zip_read16(rec + 10);
+		e->crc32 = zip_read32(rec + 16);
+		e->compressed_size = zip_read32(rec + 20);
+		e->size = zip_read32(rec + 24);
+		e->local_offset = zip_read32(rec + 42);
+		e->name_offset = names_len;
+
+		name = z->names + names_len;
+		memcpy(name, rec + ZIP_CDIR_SIZE, name_len);
+		name[name_len] = '\0';
+		for (int j = 0; j < name_len; j++) {
+			if (name[j] == '\\') name[j] = '/';
+		}
+		if (name_len > 0 && name[name_len - 1] == '/') {
+			name[--name_len] = '\0';
+			e->is_dir = true;
+		}
+		names_len += name_len + 1;
+
+		cdir_pos += ZIP_CDIR_SIZE + zip_read16(rec + 28) + zip_read16(rec + 30) + zip_read16(rec + 32);
+	}
+
+	z->table_mask = 15;
+	while (z->table_mask < z->count * 2) z->table_mask = (z->table_mask << 1) | 1;
+	z->table = calloc(z->table_mask + 1, sizeof(int));
+	if (z->table == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < z->count; i++) {
+		u32 slot = zip_hash_name(z->names + z->entries[i].name_offset) & z->table_mask;
+		while (z->table[slot] != 0) slot = (slot + 1) & z->table_mask;
+		z->table[slot] = i + 1;
+	}
+
+	return 0;
+}
+
+zip_archive *zip_archive_open(const char *filename) {
+	zip_archive *z = calloc(1, sizeof(zip_archive));
+	if (z == NULL) {
+		return NULL;
+	}
+	if (zip_archive_load(z, filename) < 0) {
+		free(z);
+		return NULL;
+	}
+	if (zip_archive_parse(z) < 0) {
+		fprintf(stderr, "zip: could not read %s\n", filename);
+		zip_archive_close(z);
+		return NULL;
+	}
+	return z;
+}
+
+void zip_archive_close(zip_archive *z) {
+	if (z == NULL) {
+		return;
+	}
+	if (z->entries != NULL) {
+		for (int i = 0; i < z->count; i++) {
+			free(z->entries[i].cache);
+		}
+	}
+#ifdef HAVE_MMAP
+	if (z->mapped) {
+		munmap((void*) z->data, z->data_len);
+	} else
+#endif
+	{
+		free((void*) z->data);
+	}
+	free(z->entries);
+	free(z->names);
+	free(z->table);
+	free(z);
+}
+
+int zip_archive_count(zip_archive *z) {
+	return z->count;
+}
+
+const char *zip_archive_name(zip_archive *z, int i) {
+	return z->names + z->entries[i].name_offset;
+}
+
+bool zip_archive_is_dir(zip_archive *z, int i) {
+	return z->entries[i].is_dir;
+}
+
+u32 zip_archive_size(zip_archive *z, int i) {
+	return z->entries[i].size;
+}
+
+// Exact matches win; otherwise, the first case-insensitive match in
+// central directory order.
+int zip_archive_find(zip_archive *z, const char *name) {
+	u32 slot = zip_hash_name(name) & z->table_mask;
+	int result = -1;
+
+	while (z->table[slot] != 0) {
+		int i = z->table[slot] - 1;
+		const char *entry_name = z->names + z->entries[i].name_offset;
+		if (strcmp(name, entry_name) == 0) {
+			return i;
+		} else if (result < 0 && strcasecmp(name, entry_name) == 0) {
+			result = i;
+		}
+		slot = (slot + 1) & z->table_mask;
+	}
+	return result;
+}
+
+#ifdef HAVE_ZLIB
+static const u8 *zip_archive_inflate(zip_archive *z, zip_entry *e, const u8 *src) {
+	z_stream strm;
+	u8 *dest = malloc(e->size > 0 ? e->size : 1);
+	int result;
+
+	if (dest == NULL) {
+		return NULL;
+	}
+
+	if (e->size > 0) {
+		memset(&strm, 0, sizeof(strm));
+		if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+			free(dest);
+			return NULL;
+		}
+		strm.next_in = (Bytef*) src;
+		strm.avail_in = e->compressed_size;
+		strm.next_out = dest;
+		strm.avail_out = e->size;
+		result = inflate(&strm, Z_FINISH);
+		inflateEnd(&strm);
+
+		if (result != Z_STREAM_END || strm.total_out != e->size || crc32(0L, dest, e->size) != e->crc32) {
+			fprintf(stderr, "zip: could not decompress %s\n", z->names + e->name_offset);
+			free(dest);
+			return NULL;
+		}
+	}
+
+	e->cache = dest;
+	return dest;
+}
+#endif
+
+const u8 *zip_archive_data(zip_archive *z, int i) {
+	zip_entry *e = &z->entries[i];
+	const char *name = z->names + e->name_offset;
+	const u8 *local;
+	size_t data_pos;
+
+	if (e->cache != NULL) {
+		return e->cache;
+	}
+	if (e->is_dir) {
+		return NULL;
+	}
+	if (e->flags & ZIP_FLAG_ENCRYPTED) {
+		fprintf(stderr, "zip: %s is encrypted\n", name);
+		return NULL;
+	}
+
+	// the local header repeats the name, and may carry a different extra field
+	if ((size_t) e->local_offset + ZIP_LOCAL_SIZE > z->data_len) {
+		fprintf(stderr, "zip: invalid local header for %s\n", name);
+		return NULL;
+	}
+	local = z->data + e->local_offset;
+	data_pos = (size_t) e->local_offset + ZIP_LOCAL_SIZE + zip_read16(local + 26) + zip_read16(local + 28);
+	if (zip_read32(local) != ZIP_LOCAL_SIGNATURE || data_pos + e->compressed_size > z->data_len) {
+		fprintf(stderr, "zip: invalid local header for %s\n", name);
+		return NULL;
+	}
+
+	switch (e->method) {
+		case ZIP_METHOD_STORED:
+			if (e->compressed_size != e->size) {
+				fprintf(stderr, "zip: invalid size for %s\n", name);
+				return NULL;
+			}
+			return z->data + data_pos;
+		case ZIP_METHOD_DEFLATED:
+#ifdef HAVE_ZLIB
+			return zip_archive_inflate(z, e, z->data + data_pos);
+#else
+			fprintf(stderr, "zip: %s is compressed, but zlib support is not available\n", name);
+			return NULL;
+#endif
+		default:
+			fprintf(stderr, "zip: %s uses unsupported compression method %d\n", name, e->method);
+			return NULL;
+	}
+}
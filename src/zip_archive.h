@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2018, 2019, 2020, 2021 Adrian Siekierka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ZIP_ARCHIVE_H__
+#define __ZIP_ARCHIVE_H__
+
+#include "types.h"
+
+typedef struct s_zip_archive zip_archive;
+
+// Read-only access to a ZIP file, mapped into memory. Entry names use '/'
+// as the path separator; directory entries have their trailing '/' removed.
+// Lookups by name are case-insensitive.
+
+zip_archive *zip_archive_open(const char *filename);
+void zip_archive_close(zip_archive *z);
+int zip_archive_count(zip_archive *z);
+const char *zip_archive_name(zip_archive *z, int i);
+bool zip_archive_is_dir(zip_archive *z, int i);
+u32 zip_archive_size(zip_archive *z, int i);
+int zip_archive_find(zip_archive *z, const char *name);
+// Stored entries point straight into the mapping; deflated entries are
+// decompressed on first use and kept until the archive is closed.
+// Returns NULL on error.
+const u8 *zip_archive_data(zip_archive *z, int i);
+
+#endif /* __ZIP_ARCHIVE_H__ */
@@ -146,6 +146,11 @@ const char *zzt_style_names[] = {
 
 zzt_state zzt;
 
+// registered VRAM dirty bitmaps; see zzt_update_vram_dirty()
+#define VRAM_DIRTY_CONSUMERS_MAX 8
+static zzt_vram_dirty *vram_dirty_consumers[VRAM_DIRTY_CONSUMERS_MAX];
+static int vram_dirty_count = 0;
+
 u32 zzt_get_ip(void) {
 	return cpu_get_ip(&zzt.cpu);
 }
@@ -592,6 +597,9 @@ static void video_scroll_up(cpu_state* cpu, int lines, u8 empty_attr, int y1, in
 			cpu->ram[TEXT_ADDR(x,y)+1] = empty_attr;
 		}
 	}
+
+	for (int y = y1; y <= y2; y++)
+		cpu_mark_vram_dirty(cpu, TEXT_ADDR(x1,y), (x2 - x1 + 1) * 2);
 }
 
 static void cpu_0x10_output(cpu_state* cpu, u8 chr) {
@@ -613,11 +621,13 @@ static void cpu_0x10_output(cpu_state* cpu, u8 chr) {
 			if (cpu->ram[0x450] > 0)
 				cpu->ram[0x450]--;
 			cpu->ram[TEXT_ADDR(cpu->ram[0x450], cpu->ram[0x451])] = 0;
+			cpu_mark_vram_dirty(cpu, TEXT_ADDR(cpu->ram[0x450], cpu->ram[0x451]), 1);
 			break;
 		case 0x07:
 			break;
 		default:
 			cpu->ram[TEXT_ADDR(cpu->ram[0x450], cpu->ram[0x451])] = chr;
+			cpu_mark_vram_dirty(cpu, TEXT_ADDR(cpu->ram[0x450], cpu->ram[0x451]), 1);
 			cpu->ram[0x450]++;
 			if (cpu->ram[0x450] >= cursor_width) {
 				cpu->ram[0x450] = 0;
@@ -668,6 +678,7 @@ static void cpu_func_intr_0x10(cpu_state* cpu) {
 	switch (cpu->ah) {
 		case 0x00: // set video mode
 			video_mode = cpu->al & 0x7F;
+			cpu_mark_vram_dirty(cpu, VRAM_DIRTY_BASE, VRAM_DIRTY_CELLS * 2);
 			if (zzt.charset_default && zzt.style == ZZT_STYLE_DEFAULT) {
 				zzt_load_charset_default();
 			}
@@ -709,6 +720,7 @@ static void cpu_func_intr_0x10(cpu_state* cpu) {
 				cpu->ram[addr] = cpu->al;
 				if (cpu->ah == 0x09) cpu->ram[addr + 1] = cpu->bl;
 			}
+			cpu_mark_vram_dirty(cpu, TEXT_ADDR(cpu->bl, cpu->bh), addr - TEXT_ADDR(cpu->bl, cpu->bh));
 		} return;
 		case 0x0E:
 			cpu_0x10_output(cpu, cpu->al);
@@ -1223,6 +1235,7 @@ static int cpu_func_intr_0x21(cpu_state* cpu) {
 					cpu->ax = 0x05;
 					cpu->flags |= FLAG_CARRY;
 				} else {
+					cpu_mark_vram_dirty(cpu, (cpu->seg[SEG_DS]*16 + cpu->dx) & 0xFFFFF, res);
 					cpu->ax = res;
 					cpu->flags &= ~FLAG_CARRY;
 				}
@@ -1707,3 +1720,53 @@ void zzt_mark_timer_turbo(void) {
 u8* zzt_get_ram(void) {
 	return zzt.cpu.ram;
 }
+
+void zzt_register_vram_dirty(zzt_vram_dirty *d) {
+	memset(d->cells, 0xFF, sizeof(d->cells));
+	d->any = true;
+	d->registered = false;
+	if (vram_dirty_count >= VRAM_DIRTY_CONSUMERS_MAX) {
+		fprintf(stderr, "too many VRAM dirty consumers (max %d)\n", VRAM_DIRTY_CONSUMERS_MAX);
+		return;
+	}
+	vram_dirty_consumers[vram_dirty_count++] = d;
+	d->registered = true;
+}
+
+void zzt_unregister_vram_dirty(zzt_vram_dirty *d) {
+	for (int i = 0; i < vram_dirty_count; i++) {
+		if (vram_dirty_consumers[i] == d) {
+			vram_dirty_consumers[i] = vram_dirty_consumers[--vram_dirty_count];
+			break;
+		}
+	}
+	d->registered = false;
+}
+
+void zzt_update_vram_dirty(void) {
+	if (!zzt.cpu.vram_dirty_any) {
+		return;
+	}
+	for (int i = 0; i < vram_dirty_count; i++) {
+		zzt_vram_dirty *d = vram_dirty_consumers[i];
+		for (int j = 0; j < (VRAM_DIRTY_CELLS >> 3); j++) {
+			d->cells[j] |= zzt.cpu.vram_dirty[j];
+		}
+		d->any = true;
+	}
+	memset(zzt.cpu.vram_dirty, 0, sizeof(zzt.cpu.vram_dirty));
+	zzt.cpu.vram_dirty_any = false;
+}
+
+void zzt_clear_vram_dirty(zzt_vram_dirty *d) {
+	if (d->registered && d->any) {
+		memset(d->cells, 0, sizeof(d->cells));
+		d->any = false;
+	}
+}
+
+void zzt_mark_vram_dirty(int offset, int length) {
+	if (offset >= 0 && length > 0) {
+		cpu_mark_vram_dirty(&zzt.cpu, VRAM_DIRTY_BASE + offset, length);
+	}
+}
@@ -91,6 +91,29 @@ USER_FUNCTION
 int zzt_execute(int opcodes);
 USER_FUNCTION
 u8* zzt_get_ram(void);
+// VRAM dirty tracking. Every consumer of the text screen (renderer,
+// recorder, streamer) owns a zzt_vram_dirty and registers it, starting out
+// fully dirty. zzt_update_vram_dirty() hands the writes made since the last
+// update to all registered consumers; each consumer clears only its own
+// bitmap once it has caught up. Bit (n & 7) of cells[n >> 3] is set if text
+// cell n (at 0xB8000 + n*2) was written. A consumer which could not be
+// registered stays fully dirty.
+typedef struct {
+	u8 cells[VRAM_DIRTY_CELLS >> 3];
+	bool any;
+	bool registered;
+} zzt_vram_dirty;
+
+USER_FUNCTION
+void zzt_register_vram_dirty(zzt_vram_dirty *d);
+USER_FUNCTION
+void zzt_unregister_vram_dirty(zzt_vram_dirty *d);
+USER_FUNCTION
+void zzt_update_vram_dirty(void);
+USER_FUNCTION
+void zzt_clear_vram_dirty(zzt_vram_dirty *d);
+USER_FUNCTION
+void zzt_mark_vram_dirty(int offset, int length);
 USER_FUNCTION
 void zzt_mark_frame(void);
 USER_FUNCTION